@@ -2,12 +2,16 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
+struct page;
 struct pipe;
 struct proc;
+struct shm;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct vma;
 
 // bio.c
 void            binit(void);
@@ -23,7 +27,13 @@ void            consoleintr(int);
 void            consputc(int);
 
 // exec.c
+struct execseg;
 int             exec(char*, char**);
+int             execproc(struct proc*, char*, char**);
+void            execsegput(struct execseg*);
+void            execsegdup(struct proc*, struct proc*);
+struct execseg* findseg(struct proc*, uint64);
+int             segfault(struct execseg*, uint64, int);
 
 // file.c
 struct file*    filealloc(void);
@@ -52,6 +62,7 @@ struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
+int             writeipage(struct inode*, uint64, uint, uint);
 void            itrunc(struct inode*);
 
 // ramdisk.c
@@ -63,9 +74,28 @@ void            ramdiskrw(struct buf*);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+void*           kalloc_zeroed(void);
+void            pagezero(void*);
 
 void            incref(uint64 pa);
 void            decref(uint64 pa);
+int             getref(uint64 pa);
+int             kunref(void*);
+struct page*    pa2page(uint64);
+int             kfreepages(void);
+void*           kalloc_order(int);
+void            kfree_order(void*, int);
+void            kbuddystat(int*);
+void*           khugealloc(void);
+void            khugeget(uint64);
+void            khugeput(uint64);
+void            khugesplit(uint64);
+
+// slab.c
+void            slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -73,7 +103,23 @@ void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
 
+// mmap.c
+struct vma*     findvma(struct proc*, uint64);
+uint64          mmap(uint64, uint64, int, int, struct file*, uint);
+int             munmap(uint64, uint64);
+int             vmafault(struct proc*, struct vma*, uint64, int);
+int             vmacopy(struct proc*, struct proc*);
+void            vmaunmapall(struct proc*);
+
+// pagecache.c
+void            pcacheinit(void);
+uint64          pcache_get(struct inode*, uint, uint);
+uint64          pcache_put(struct inode*, uint, uint, uint64);
+void            pcache_invalidate(uint, uint);
+int             pcache_reclaim(void);
+
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
@@ -88,6 +134,7 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+int             spawn(char*, char**, int*);
 int             growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
@@ -106,6 +153,9 @@ void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
 void            yield(void);
+int             timeslice(struct proc*);
+int             settickets(int);
+void            mlfqboost(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
@@ -121,6 +171,22 @@ void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
 
+// shm.c
+void            shminit(void);
+struct shm*     shmalloc(int);
+void            shmdup(struct shm*);
+void            shmput(struct shm*);
+uint64          shmpage(struct shm*, int);
+
+// swap.c
+void            swapinit(void);
+int             swapout(void);
+int             swapin(struct proc*, uint64);
+void            swapdup(pte_t);
+void            swapfree(pte_t);
+void*           ualloc(void);
+void            swapstat(int*, int*);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
@@ -150,6 +216,10 @@ void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
+void            clockintr(void);
+void            timerarm(void);
+int             ticksleep(uint);
+void            ipi(int);
 
 // uart.c
 void            uartinit(void);
@@ -172,14 +242,21 @@ void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
 pte_t *         walk(pagetable_t, uint64, int);
+pte_t *         walkmod(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
+void            tlbflush(pagetable_t, uint64);
+extern int      asidmax;
+extern char     *zeropage;
+uint64          ufault(uint64, uint64, int);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
 
 int uvmcopycow(pagetable_t old, pagetable_t new, uint64 sz);
+int uvmcopyvma(pagetable_t old, pagetable_t new, uint64 va, uint64 len, int shared);
 // void uvmdealloccow(pagetable_t pagetable, uint64 sz);
 int handle_cow_fault(uint64 va);
+int handle_lazy_fault(uint64 va, int write);
 
 // plic.c
 void            plicinit(void);
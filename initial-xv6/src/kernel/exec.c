@@ -6,6 +6,9 @@
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
 
 static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
 
@@ -22,17 +25,50 @@ int flags2perm(int flags)
     return perm;
 }
 
+// Map the pages of read-only segment s that are already in the
+// page cache, typically because another process is running the
+// same binary, so that they are shared and never fault.
+static int
+mapcached(pagetable_t pagetable, struct execseg *s)
+{
+  uint64 va, pa;
+  uint n;
+
+  for(va = s->va; va < s->va + s->filesz; va += PGSIZE){
+    n = s->filesz - (va - s->va) < PGSIZE ? s->filesz - (va - s->va) : PGSIZE;
+    if((pa = pcache_get(s->ip, s->off + (va - s->va), n)) == 0)
+      continue;
+    if(mappages(pagetable, va, PGSIZE, pa, s->perm) != 0){
+      kfree((void*)pa);
+      return -1;
+    }
+  }
+  return 0;
+}
+
 int
 exec(char *path, char **argv)
+{
+  return execproc(myproc(), path, argv);
+}
+
+// Replace p's user memory with the program path, run with
+// arguments argv. p is either the caller or a new process
+// that is not runnable yet (see spawn()). Returns argc, or
+// -1 with p left untouched.
+int
+execproc(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
+  int i, off, nseg = 0;
   uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
+  struct execseg seg[NEXECSEG], oldseg[NEXECSEG];
   pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
+
+  memset(seg, 0, sizeof(seg));
 
   begin_op();
 
@@ -65,6 +101,23 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
+    if(nseg < NEXECSEG){
+      // Record the segment and map whatever of it is in the
+      // page cache already; segfault() reads the rest in from
+      // the file when it is first touched.
+      struct execseg *es = &seg[nseg++];
+      es->ip = idup(ip);
+      es->va = ph.vaddr;
+      es->memsz = ph.memsz;
+      es->filesz = ph.filesz;
+      es->off = ph.off;
+      es->perm = PTE_R | PTE_U | flags2perm(ph.flags);
+      if(ph.vaddr + ph.memsz > sz)
+        sz = ph.vaddr + ph.memsz;
+      if((es->perm & PTE_W) == 0 && mapcached(pagetable, es) < 0)
+        goto bad;
+      continue;
+    }
     uint64 sz1;
     // if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, PTE_W)) == 0)
     if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
@@ -125,14 +178,23 @@ exec(char *path, char **argv)
 
   // Commit to the user image.
 
+  // mmap regions belong to the old image; write them back.
+  vmaunmapall(p);
+
   // Update process to use the new pagetable and size.
   p->pagetable = pagetable;
   p->sz = sz;
   p->trapframe->epc = elf.entry;  // Initial program counter = main
   p->trapframe->sp = sp;          // Initial stack pointer
+  memmove(oldseg, p->seg, sizeof(oldseg));
+  memmove(p->seg, seg, sizeof(seg));
+  p->hugeheap = 0;
+  // the ASID's TLB entries on every hart are for the old image.
+  __atomic_store_n(&p->tlbstale, TLB_ALLHARTS, __ATOMIC_RELEASE);
 
   // Free the old pagetable and address space.
   proc_freepagetable(oldpagetable, oldsz);
+  execsegput(oldseg);
 
   return argc; // This ends up in a0, the first argument to main(argc, argv)
 
@@ -143,6 +205,7 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  execsegput(seg);
   return -1;
 }
 
@@ -170,3 +233,107 @@ loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz
   
   return 0;
 }
+
+// Release the inodes held by exec segments seg[0..NEXECSEG).
+// Must not be called inside a file system transaction.
+void
+execsegput(struct execseg *seg)
+{
+  int i;
+
+  for(i = 0; i < NEXECSEG && seg[i].ip == 0; i++)
+    ;
+  if(i == NEXECSEG)
+    return;
+
+  begin_op();
+  for(i = 0; i < NEXECSEG; i++){
+    if(seg[i].ip){
+      iput(seg[i].ip);
+      seg[i].ip = 0;
+    }
+  }
+  end_op();
+}
+
+// Give fork()'s child np its own references to p's segments.
+void
+execsegdup(struct proc *np, struct proc *p)
+{
+  for(int i = 0; i < NEXECSEG; i++){
+    np->seg[i] = p->seg[i];
+    if(np->seg[i].ip)
+      idup(np->seg[i].ip);
+  }
+}
+
+// Return p's exec segment containing va, or 0 if none.
+struct execseg *
+findseg(struct proc *p, uint64 va)
+{
+  struct execseg *s;
+
+  for(s = p->seg; s < &p->seg[NEXECSEG]; s++){
+    if(s->ip && va >= s->va && va < s->va + s->memsz)
+      return s;
+  }
+  return 0;
+}
+
+// Page in the page of the current process at va, which lies in
+// exec segment s and is not mapped yet. Read-only pages come from,
+// and go into, the exec page cache. Returns 0 if the page was
+// mapped, 1 if it is a writable page with no file data (bss),
+// which the caller should zero-fill like the heap, or -1 on error.
+int
+segfault(struct execseg *s, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  uint64 pa, off;
+  uint n;
+  char *mem;
+
+  va = PGROUNDDOWN(va);
+  if(write && (s->perm & PTE_W) == 0)
+    return -1;
+
+  n = 0;
+  if(va - s->va < s->filesz)
+    n = s->filesz - (va - s->va) < PGSIZE ? s->filesz - (va - s->va) : PGSIZE;
+  if(n == 0 && (s->perm & PTE_W))
+    return 1;
+  off = s->off + (va - s->va);
+
+  ilock(s->ip);
+
+  pa = 0;
+  if((s->perm & PTE_W) == 0)
+    pa = pcache_get(s->ip, off, n);
+  if(pa == 0){
+    if((mem = ualloc()) == 0)
+      goto bad;
+    memset(mem + n, 0, PGSIZE - n);
+    if(readi(s->ip, 0, (uint64)mem, off, n) != n){
+      kfree(mem);
+      goto bad;
+    }
+    pa = (uint64)mem;
+    if((s->perm & PTE_W) == 0){
+      pa = pcache_put(s->ip, off, n, pa);
+      if(pa != (uint64)mem)
+        kfree(mem);
+    }
+  }
+
+  iunlock(s->ip);
+
+  if(mappages(p->pagetable, va, PGSIZE, pa, s->perm) != 0){
+    kfree((void*)pa);
+    return -1;
+  }
+  return 0;
+
+ bad:
+  iunlock(s->ip);
+  return -1;
+}
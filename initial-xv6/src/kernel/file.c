@@ -14,15 +14,19 @@
 #include "proc.h"
 
 struct devsw devsw[NDEV];
+// File structures come from a slab cache, so the number
+// open at once is limited only by memory. ftable.lock
+// protects their reference counts.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct kmem_cache *cache;
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  ftable.cache = kmem_cache_create("file", sizeof(struct file));
 }
 
 // Allocate a file structure.
@@ -31,16 +35,11 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = kmem_cache_alloc(ftable.cache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,9 +68,8 @@ fileclose(struct file *f)
     return;
   }
   ff = *f;
-  f->ref = 0;
-  f->type = FD_NONE;
   release(&ftable.lock);
+  kmem_cache_free(ftable.cache, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
@@ -107,6 +105,7 @@ int
 fileread(struct file *f, uint64 addr, int n)
 {
   int r = 0;
+  uint m;
 
   if(f->readable == 0)
     return -1;
@@ -118,8 +117,20 @@ fileread(struct file *f, uint64 addr, int n)
       return -1;
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
+    // readi() copies out with the inode and a buffer locked,
+    // so fault in the destination first, as far as the file
+    // goes. If the file grows meanwhile, read no more.
     ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
+    m = f->off < f->ip->size ? f->ip->size - f->off : 0;
+    iunlock(f->ip);
+    if(n <= 0)
+      m = 0;
+    else if(m > n)
+      m = n;
+    if(ufault(addr, m, 1) < m)
+      return -1;
+    ilock(f->ip);
+    if((r = readi(f->ip, 1, addr, f->off, m)) > 0)
       f->off += r;
     iunlock(f->ip);
   } else {
@@ -159,6 +170,9 @@ filewrite(struct file *f, uint64 addr, int n)
       if(n1 > max)
         n1 = max;
 
+      // writei() copies in with the inode and a buffer locked.
+      if(ufault(addr + i, n1, 0) < n1)
+        break;
       begin_op();
       ilock(f->ip);
       if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
@@ -130,7 +130,7 @@ bfree(int dev, uint b)
 //   the reference and link counts have fallen to zero.
 //
 // * Referencing in table: an entry in the inode table
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
+//   is unused if ip->ref is zero. Otherwise ip->ref tracks
 //   the number of in-memory pointers to the entry (open
 //   files and current directories). iget() finds or
 //   creates a table entry and increments its ref; iput()
@@ -164,10 +164,18 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
+// The table is a list of inodes allocated from a slab cache.
+// Unused entries stay on it as a cache of recent inodes, up to
+// NINODE entries in all; past that, iget() adds entries only
+// while all of them are in use, and iput() frees them again as
+// they fall out of use. So NINODE bounds the cache, not the
+// number of inodes that can be in use at once.
+//
 // The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
+// entries. Since ip->ref indicates whether an entry is in use,
 // and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// holds, one must hold itable.lock while using any of those
+// fields, and ip->next.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
@@ -175,18 +183,16 @@ bfree(int dev, uint b)
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *head;
+  int n;                   // entries on the list
+  struct kmem_cache *cache;
 } itable;
 
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
-  }
+  itable.cache = kmem_cache_create("inode", sizeof(struct inode));
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -252,7 +258,7 @@ iget(uint dev, uint inum)
 
   // Is the inode already in the table?
   empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
+  for(ip = itable.head; ip; ip = ip->next){
     if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
       ip->ref++;
       release(&itable.lock);
@@ -262,11 +268,25 @@ iget(uint dev, uint inum)
       empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
+  // Add an entry, or recycle an unused one.
+  ip = 0;
+  if(empty == 0 || itable.n < NINODE)
+    ip = kmem_cache_alloc(itable.cache);
+  if(ip){
+    initsleeplock(&ip->lock, "inode");
+    ip->pcached = 0;
+    ip->next = itable.head;
+    itable.head = ip;
+    itable.n++;
+  } else if(empty){
+    ip = empty;
+    if(ip->pcached){
+      pcache_invalidate(ip->dev, ip->inum);
+      ip->pcached = 0;
+    }
+  } else {
     panic("iget: no inodes");
-
-  ip = empty;
+  }
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
@@ -326,9 +346,25 @@ iunlock(struct inode *ip)
   releasesleep(&ip->lock);
 }
 
+// Take unused entry ip off the inode table and free it.
+// Caller must hold itable.lock.
+static void
+ifree(struct inode *ip)
+{
+  struct inode **pp;
+
+  for(pp = &itable.head; *pp != ip; pp = &(*pp)->next)
+    ;
+  *pp = ip->next;
+  itable.n--;
+  if(ip->pcached)
+    pcache_invalidate(ip->dev, ip->inum);
+  kmem_cache_free(itable.cache, ip);
+}
+
 // Drop a reference to an in-memory inode.
 // If that was the last reference, the inode table entry can
-// be recycled.
+// be recycled, or is freed if the table is over NINODE.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -358,6 +394,8 @@ iput(struct inode *ip)
   }
 
   ip->ref--;
+  if(ip->ref == 0 && itable.n > NINODE)
+    ifree(ip);
   release(&itable.lock);
 }
 
@@ -450,6 +488,11 @@ itrunc(struct inode *ip)
 
   ip->size = 0;
   iupdate(ip);
+
+  if(ip->pcached){
+    pcache_invalidate(ip->dev, ip->inum);
+    ip->pcached = 0;
+  }
 }
 
 // Copy stat information from inode.
@@ -495,6 +538,8 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   return tot;
 }
 
+static int iwrite(struct inode*, int, uint64, uint, uint);
+
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
@@ -505,14 +550,41 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
-  uint tot, m;
-  struct buf *bp;
+  if(off > ip->size || off + n < off)
+    return -1;
+  if(off + n > MAXFILE*BSIZE)
+    return -1;
+
+  if(ip->pcached){
+    pcache_invalidate(ip->dev, ip->inum);
+    ip->pcached = 0;
+  }
 
+  return iwrite(ip, user_src, src, off, n);
+}
+
+// Write back n bytes of a MAP_SHARED page of ip, at kernel
+// address pa, to file offset off. Unlike writei(), keeps the
+// file's cached pages: pa is normally one of them, other
+// processes may still map it, and it already holds the data.
+// Caller must hold ip->lock.
+int
+writeipage(struct inode *ip, uint64 pa, uint off, uint n)
+{
   if(off > ip->size || off + n < off)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  return iwrite(ip, 0, pa, off, n);
+}
+
+static int
+iwrite(struct inode *ip, int user_src, uint64 src, uint off, uint n)
+{
+  uint tot, m;
+  struct buf *bp;
+
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     uint addr = bmap(ip, off/BSIZE);
     if(addr == 0)
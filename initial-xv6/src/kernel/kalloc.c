@@ -1,6 +1,28 @@
 // Physical memory allocator, for user processes,
-// kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// kernel stacks, page-table pages, slabs (see slab.c),
+// and anything else that needs physically contiguous memory.
+//
+// Free memory is kept by a binary buddy allocator: free blocks
+// of 2^order pages, for order 0 to MAXORDER, each aligned to its
+// own size, on one list per order. kalloc_order() splits a larger
+// block if there is no block of the size asked for, and freeing a
+// block merges it with its buddy (the other half of the block of
+// twice its size) for as long as the buddy is free too. The first
+// page's metadata records a free block's order (PG_BUDDY).
+//
+// Single pages, by far the most common, take a faster path: each
+// CPU keeps its own list of free pages, so kalloc() and kfree()
+// normally touch only the local list and its (uncontended) lock.
+// A CPU whose list runs dry refills a batch of pages from the
+// buddy allocator, or failing that steals half of another CPU's
+// list. A CPU whose list grows past KMEM_HIGH hands a batch back
+// to the buddy allocator, so freed memory does not get stranded
+// on one CPU, and can merge into larger blocks again.
+//
+// A block of more than one page is reference counted as a whole,
+// through its first page. A 2MB user heap page (see khugealloc())
+// stays that way until something needs to change part of it;
+// khugesplit() then turns it into 512 ordinary pages for good.
 
 #include "types.h"
 #include "param.h"
@@ -8,6 +30,7 @@
 #include "spinlock.h"
 #include "riscv.h"
 #include "defs.h"
+#include "page.h"
 
 void freerange(void *pa_start, void *pa_end);
 
@@ -16,74 +39,298 @@ extern char end[]; // first address after kernel.
 
 struct run {
   struct run *next;
+  struct run *prev; // buddy lists only
 };
 
-// Define the maximum number of physical pages
-#define MAX_PHYS_PAGES (PHYSTOP / PGSIZE)
+#define KMEM_BATCH 32              // pages moved per refill or drain
+#define KMEM_HIGH  (4*KMEM_BATCH)  // drain a CPU's list above this
 
-// Reference count array
-int phys_page_ref[MAX_PHYS_PAGES];
-
-struct {
+// Per-CPU free list, padded to a cache line so that
+// CPUs do not false-share each other's list heads.
+struct kmem_cpu {
   struct spinlock lock;
   struct run *freelist;
+  int nfree;
+} __attribute__((aligned(64)));
+
+struct {
+  struct spinlock lock;   // protects the buddy lists and PG_BUDDY
+  struct run *free[MAXORDER+1];
+  int nfree[MAXORDER+1];  // blocks on each list
+  struct kmem_cpu cpu[NCPU];
+
+  // Page metadata covers only the pages kalloc() manages,
+  // [base, PHYSTOP). The array itself lives in the first
+  // pages after the kernel image, just below base.
+  uint64 base;
+  uint64 npages;
+  struct page *pages;
 } kmem;
 
-// Initialize the memory allocator and reference counts
+// Initialize the memory allocator and page metadata
 void
 kinit(void)
 {
+  uint64 start, metasz;
+
   initlock(&kmem.lock, "kmem");
-  // Initialize reference counts to zero
-  memset(phys_page_ref, 0, sizeof(phys_page_ref));
-  freerange(end, (void*)PHYSTOP);
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kmem.cpu[i].lock, "kmem_cpu");
+
+  // Carve the metadata array out of the start of free memory.
+  // It is sized for [start, PHYSTOP), which slightly overcounts
+  // since its own pages are never handed out.
+  start = PGROUNDUP((uint64)end);
+  metasz = PGROUNDUP((PHYSTOP - start) / PGSIZE * sizeof(struct page));
+  kmem.pages = (struct page*)start;
+  kmem.base = start + metasz;
+  kmem.npages = (PHYSTOP - kmem.base) / PGSIZE;
+  memset(kmem.pages, 0, metasz);
+
+  printf("kinit: %d pages, metadata %dKB (flat table would be %dKB)\n",
+         (int)kmem.npages, (int)(metasz / 1024),
+         (int)(PHYSTOP / PGSIZE * sizeof(int) / 1024));
+
+  freerange((void*)kmem.base, (void*)PHYSTOP);
+}
+
+// Return the metadata for the physical page containing pa.
+struct page *
+pa2page(uint64 pa)
+{
+  if(pa < kmem.base || pa >= PHYSTOP)
+    panic("pa2page: invalid physical address");
+  return &kmem.pages[(pa - kmem.base) / PGSIZE];
+}
+
+// Return the reference count slot for physical page pa.
+static int *
+pa2ref(uint64 pa)
+{
+  return &pa2page(pa)->refcnt;
 }
 
 // Increment the reference count of a physical page
 void
 incref(uint64 pa)
 {
-  // int index = (pa - (uint64)end) / PGSIZE;
-  int index = pa / PGSIZE;
-  if(index < 0 || index >= MAX_PHYS_PAGES)
-    panic("incref: invalid physical address");
-
-  acquire(&kmem.lock);
-  phys_page_ref[index]++;
-  release(&kmem.lock);
+  __atomic_add_fetch(pa2ref(pa), 1, __ATOMIC_RELAXED);
 }
 
 
-// Decrement the reference count of a physical page
+// Decrement the reference count of a physical page,
+// without freeing it when the count reaches zero.
 void
 decref(uint64 pa)
 {
-  // int index = (pa - (uint64)end) / PGSIZE;
-  int index = pa / PGSIZE;
-  if(index < 0 || index >= MAX_PHYS_PAGES)
-    panic("decref: invalid physical address");
+  int *ref = pa2ref(pa);
+  int old = __atomic_load_n(ref, __ATOMIC_RELAXED);
 
-  acquire(&kmem.lock);
-  if(phys_page_ref[index] > 0)
-    phys_page_ref[index]--;
+  while(old > 0 &&
+        !__atomic_compare_exchange_n(ref, &old, old - 1, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+    ;
+}
 
-  // int refcnt = phys_page_ref[index];
-  release(&kmem.lock);
+// Drop a reference to page pa like kfree(), except that if it
+// is the last one, the page is not freed: return 1 and leave the
+// caller holding it, so that it can release whatever the page
+// refers to before calling kfree(). Otherwise return 0.
+int
+kunref(void *pa)
+{
+  int *ref = pa2ref((uint64)pa);
+  int old = __atomic_load_n(ref, __ATOMIC_RELAXED);
+
+  for(;;){
+    if(old <= 0)
+      panic("kunref");
+    if(old == 1)
+      return 1;
+    if(__atomic_compare_exchange_n(ref, &old, old - 1, 0,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+      return 0;
+  }
+}
+
+// Return the number of references to physical page pa.
+int
+getref(uint64 pa)
+{
+  return __atomic_load_n(pa2ref(pa), __ATOMIC_ACQUIRE);
+}
+
+// Put a free block of 2^order pages at pa on its list.
+// Caller must hold kmem.lock.
+static void
+bpush(uint64 pa, int order)
+{
+  struct run *r = (struct run*)pa;
+  struct page *pg = pa2page(pa);
+
+  pg->flags = PG_FREE | PG_BUDDY;
+  pg->order = order;
+  r->prev = 0;
+  r->next = kmem.free[order];
+  if(r->next)
+    r->next->prev = r;
+  kmem.free[order] = r;
+  kmem.nfree[order]++;
+}
+
+// Take the free block at pa off its list.
+// Caller must hold kmem.lock.
+static void
+bunlink(uint64 pa, int order)
+{
+  struct run *r = (struct run*)pa;
+
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.free[order] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.nfree[order]--;
+  pa2page(pa)->flags = 0;
+}
+
+// Return the block of 2^order pages at pa to the buddy lists,
+// merging it with its buddy as far as possible.
+// Caller must hold kmem.lock.
+static void
+bfree(uint64 pa, int order)
+{
+  uint64 buddy;
+  struct page *bp;
+
+  pa2page(pa)->flags = 0;
+  for(; order < MAXORDER; order++){
+    buddy = pa ^ ((uint64)PGSIZE << order);
+    if(buddy < kmem.base || buddy + ((uint64)PGSIZE << order) > PHYSTOP)
+      break;
+    bp = pa2page(buddy);
+    if((bp->flags & PG_BUDDY) == 0 || bp->order != order)
+      break;
+    bunlink(buddy, order);
+    if(buddy < pa)
+      pa = buddy;
+  }
+  bpush(pa, order);
+}
+
+// Take a block of 2^order pages off the buddy lists, splitting
+// a larger one if need be. Returns 0 if there is none.
+// Caller must hold kmem.lock.
+static uint64
+balloc(int order)
+{
+  uint64 pa;
+  int o;
 
-  // if(refcnt == 0){
-  //   kfree((void*)pa);
-  // }
+  for(o = order; o <= MAXORDER && kmem.free[o] == 0; o++)
+    ;
+  if(o > MAXORDER)
+    return 0;
+  pa = (uint64)kmem.free[o];
+  bunlink(pa, o);
+  // give back the upper halves.
+  while(o > order){
+    o--;
+    bpush(pa + ((uint64)PGSIZE << o), o);
+  }
+  return pa;
 }
 
+// Hand [pa_start, pa_end) to the buddy allocator, in the
+// largest aligned blocks that fit.
 void
 freerange(void *pa_start, void *pa_end)
 {
-  char *p;
-  p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  uint64 pa = PGROUNDUP((uint64)pa_start);
+  int order;
+
+  acquire(&kmem.lock);
+  while(pa + PGSIZE <= (uint64)pa_end){
+    for(order = MAXORDER; order > 0; order--){
+      uint64 sz = (uint64)PGSIZE << order;
+      if(pa % sz == 0 && pa + sz <= (uint64)pa_end)
+        break;
+    }
+    bpush(pa, order);
+    pa += (uint64)PGSIZE << order;
+  }
+  release(&kmem.lock);
+}
+
+// Move up to n pages from the front of *src to the front of *dst.
+// Returns the number of pages moved.
+// Caller must hold the locks protecting both lists.
+static int
+kmove(struct run **dst, struct run **src, int n)
+{
+  struct run *r;
+  int i;
+
+  for(i = 0; i < n && (r = *src) != 0; i++){
+    *src = r->next;
+    r->next = *dst;
+    *dst = r;
+  }
+  return i;
+}
+
+// Refill CPU id's empty free list, first from the buddy
+// allocator and then by stealing half of some other CPU's list.
+// Only one lock is held at a time, so two CPUs refilling
+// from each other cannot deadlock.
+// Must be called with interrupts disabled and without
+// holding kmem.cpu[id].lock.
+static void
+krefill(int id)
+{
+  struct kmem_cpu *kc;
+  struct run *batch = 0, *r;
+  int n;
+
+  acquire(&kmem.lock);
+  for(n = 0; n < KMEM_BATCH && (r = (struct run*)balloc(0)) != 0; n++){
+    pa2page((uint64)r)->flags = PG_FREE;
+    r->next = batch;
+    batch = r;
+  }
+  release(&kmem.lock);
+
+  for(int i = 1; n == 0 && i < NCPU; i++){
+    kc = &kmem.cpu[(id + i) % NCPU];
+    acquire(&kc->lock);
+    n = kmove(&batch, &kc->freelist, (kc->nfree + 1) / 2);
+    kc->nfree -= n;
+    release(&kc->lock);
+  }
+
+  if(n == 0)
+    return;
+
+  kc = &kmem.cpu[id];
+  acquire(&kc->lock);
+  kc->nfree += kmove(&kc->freelist, &batch, n);
+  release(&kc->lock);
 }
 
+// Give the pages on list back to the buddy allocator.
+static void
+kreturn(struct run *list)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  while((r = list) != 0){
+    list = r->next;
+    bfree((uint64)r, 0);
+  }
+  release(&kmem.lock);
+}
 
 // Free the page of physical memory pointed at by pa,
 // which normally should have been returned by a
@@ -92,28 +339,41 @@ void
 kfree(void *pa)
 {
   struct run *r;
+  struct kmem_cpu *kc;
+  struct run *batch = 0;
 
-  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+  if(((uint64)pa % PGSIZE) != 0 || (uint64)pa < kmem.base || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
-  // int index = ((uint64)pa - PGROUNDDOWN((uint64)end)) / PGSIZE;
-  int index = (uint64)pa / PGSIZE;
-  if(index < 0 || index >= MAX_PHYS_PAGES)
-    panic("kfree: invalid index");
+  // Only free if reference count reaches 0. The acquire half
+  // of the ordering makes every other CPU's writes to the page
+  // visible before it is recycled.
+  int ref = __atomic_sub_fetch(pa2ref((uint64)pa), 1, __ATOMIC_ACQ_REL);
+  if(ref > 0)
+    return;
+  if(ref < 0)
+    panic("kfree: refcount");
 
-  acquire(&kmem.lock);
-  phys_page_ref[index]--;
-  
-  // Only free if reference count reaches 0
-  if(phys_page_ref[index] <= 0) {
-    // Fill with junk to catch dangling refs.
-    memset(pa, 1, PGSIZE);
-    r = (struct run*)pa;
-    r->next = kmem.freelist;
-    kmem.freelist = r;
-    phys_page_ref[index] = 0; // Ensure it's exactly 0
-  }
-  release(&kmem.lock);
+#ifdef KDEBUG
+  // Fill with junk to catch dangling refs.
+  memset(pa, 1, PGSIZE);
+#endif
+  r = (struct run*)pa;
+  pa2page((uint64)pa)->flags = PG_FREE;
+
+  push_off();
+  kc = &kmem.cpu[cpuid()];
+  acquire(&kc->lock);
+  r->next = kc->freelist;
+  kc->freelist = r;
+  kc->nfree++;
+  if(kc->nfree > KMEM_HIGH)
+    kc->nfree -= kmove(&batch, &kc->freelist, KMEM_BATCH);
+  release(&kc->lock);
+
+  if(batch)
+    kreturn(batch);
+  pop_off();
 }
 
 
@@ -124,20 +384,253 @@ void *
 kalloc(void)
 {
   struct run *r;
+  struct kmem_cpu *kc;
+  int id;
+
+  push_off();
+  id = cpuid();
+  kc = &kmem.cpu[id];
+
+  acquire(&kc->lock);
+  if(kc->freelist == 0){
+    release(&kc->lock);
+    krefill(id);
+    acquire(&kc->lock);
+  }
+  r = kc->freelist;
+  if(r){
+    kc->freelist = r->next;
+    kc->nfree--;
+  }
+  release(&kc->lock);
+  pop_off();
+
+  // Out of memory: give back page-cache pages nobody maps.
+  if(r == 0 && pcache_reclaim() > 0)
+    return kalloc();
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
   if(r)
   {
-    kmem.freelist = r->next;
+    struct page *pg = pa2page((uint64)r);
+    if((pg->flags & PG_FREE) == 0)
+      panic("kalloc: page not free");
+    pg->flags = 0;
+#ifdef KDEBUG
     memset((char*)r, 5, PGSIZE); // Fill with junk
+#endif
 
-    // int index = ((uint64)r - PGROUNDDOWN((uint64)end)) / PGSIZE;
-    int index = (uint64)r / PGSIZE;
-    if(index >= 0 || index < MAX_PHYS_PAGES)
-      phys_page_ref[index] = 1;
+    __atomic_store_n(&pg->refcnt, 1, __ATOMIC_RELEASE);
   }
-  release(&kmem.lock);
 
   return (void*)r;
 }
+
+// Zero the page at pa, eight words per iteration; much quicker
+// than memset(), which stores a byte at a time.
+void
+pagezero(void *pa)
+{
+  uint64 *p = (uint64*)pa;
+  uint64 *e = p + PGSIZE/sizeof(uint64);
+
+  for(; p < e; p += 8){
+    p[0] = 0;
+    p[1] = 0;
+    p[2] = 0;
+    p[3] = 0;
+    p[4] = 0;
+    p[5] = 0;
+    p[6] = 0;
+    p[7] = 0;
+  }
+}
+
+// Allocate one zeroed page of physical memory.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
+  void *pa;
+
+  if((pa = kalloc()) != 0)
+    pagezero(pa);
+  return pa;
+}
+
+// Give every CPU's free pages back to the buddy allocator, so
+// that they can merge into larger blocks.
+static void
+kdrain(void)
+{
+  struct kmem_cpu *kc;
+  struct run *list;
+
+  for(int i = 0; i < NCPU; i++){
+    kc = &kmem.cpu[i];
+    acquire(&kc->lock);
+    list = kc->freelist;
+    kc->freelist = 0;
+    kc->nfree = 0;
+    release(&kc->lock);
+    kreturn(list);
+  }
+}
+
+// Allocate 2^order physically contiguous pages, aligned to
+// their size, with one reference held through the first page.
+// Their contents are undefined. Returns 0 if there is no free
+// block that large.
+void *
+kalloc_order(int order)
+{
+  uint64 pa;
+
+  if(order < 0 || order > MAXORDER)
+    panic("kalloc_order");
+  if(order == 0)
+    return kalloc();
+
+  acquire(&kmem.lock);
+  pa = balloc(order);
+  release(&kmem.lock);
+  if(pa == 0){
+    // the CPUs' lists may hold the missing pieces.
+    kdrain();
+    acquire(&kmem.lock);
+    pa = balloc(order);
+    release(&kmem.lock);
+  }
+  if(pa == 0)
+    return 0;
+  __atomic_store_n(&pa2page(pa)->refcnt, 1, __ATOMIC_RELEASE);
+  return (void*)pa;
+}
+
+// Drop a reference to the block of 2^order pages at pa, which
+// kalloc_order(order) returned, and free it with the last.
+void
+kfree_order(void *pa, int order)
+{
+  if(order == 0){
+    kfree(pa);
+    return;
+  }
+  if(order < 0 || order > MAXORDER || (uint64)pa % ((uint64)PGSIZE << order) != 0 ||
+     (uint64)pa < kmem.base || (uint64)pa >= PHYSTOP)
+    panic("kfree_order");
+
+  int ref = __atomic_sub_fetch(pa2ref((uint64)pa), 1, __ATOMIC_ACQ_REL);
+  if(ref > 0)
+    return;
+  if(ref < 0)
+    panic("kfree_order: refcount");
+
+  acquire(&kmem.lock);
+  bfree((uint64)pa, order);
+  release(&kmem.lock);
+}
+
+// Allocate a 2MB-aligned 2MB page, with one reference.
+// Returns 0 if memory is too fragmented.
+void *
+khugealloc(void)
+{
+  void *pa;
+
+  if((pa = kalloc_order(MEGAORDER)) != 0)
+    pa2page((uint64)pa)->flags = PG_HUGE;
+  return pa;
+}
+
+// Take a reference to the 2MB page at pa on behalf of a new
+// megapage mapping of it. If the page has been split, that is
+// a reference to each of its 512 pages.
+void
+khugeget(uint64 pa)
+{
+  acquire(&kmem.lock);
+  if(pa2page(pa)->flags & PG_HUGE){
+    incref(pa);
+  } else {
+    for(int i = 0; i < 512; i++)
+      incref(pa + i*PGSIZE);
+  }
+  release(&kmem.lock);
+}
+
+// Drop the reference of a megapage mapping of the 2MB page at
+// pa. The last reference to an unsplit page frees it whole.
+void
+khugeput(uint64 pa)
+{
+  struct page *pg = pa2page(pa);
+
+  acquire(&kmem.lock);
+  if(pg->flags & PG_HUGE){
+    if(--pg->refcnt == 0)
+      bfree(pa, MEGAORDER);
+    release(&kmem.lock);
+  } else {
+    release(&kmem.lock);
+    for(int i = 0; i < 512; i++)
+      kfree((void*)(pa + i*PGSIZE));
+  }
+}
+
+// Turn the 2MB page at pa, if it has not been already, into
+// 512 ordinary pages, each with the whole page's reference
+// count: every megapage mapping of it now holds a reference to
+// each page, and the pages go back to the ordinary free lists
+// one by one as they are freed.
+void
+khugesplit(uint64 pa)
+{
+  struct page *pg = pa2page(pa);
+
+  acquire(&kmem.lock);
+  if(pg->flags & PG_HUGE){
+    for(int i = 1; i < 512; i++){
+      pg[i].refcnt = pg->refcnt;
+      pg[i].flags = 0;
+    }
+    pg->flags = 0;
+  }
+  release(&kmem.lock);
+}
+
+// Return the number of free pages, summed over the buddy
+// lists and every CPU's list. Only a snapshot: other CPUs
+// keep allocating while the lists are counted.
+int
+kfreepages(void)
+{
+  int n = 0;
+
+  acquire(&kmem.lock);
+  for(int o = 0; o <= MAXORDER; o++)
+    n += kmem.nfree[o] << o;
+  release(&kmem.lock);
+  for(int i = 0; i < NCPU; i++){
+    acquire(&kmem.cpu[i].lock);
+    n += kmem.cpu[i].nfree;
+    release(&kmem.cpu[i].lock);
+  }
+  return n;
+}
+
+// Fill nfree[o] with the number of free blocks of 2^o pages,
+// for o up to MAXORDER. Pages on the CPUs' lists count as
+// single pages.
+void
+kbuddystat(int *nfree)
+{
+  acquire(&kmem.lock);
+  for(int o = 0; o <= MAXORDER; o++)
+    nfree[o] = kmem.nfree[o];
+  release(&kmem.lock);
+  for(int i = 0; i < NCPU; i++){
+    acquire(&kmem.cpu[i].lock);
+    nfree[0] += kmem.cpu[i].nfree;
+    release(&kmem.cpu[i].lock);
+  }
+}
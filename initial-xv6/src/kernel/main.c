@@ -17,6 +17,7 @@ main()
     printf("xv6 kernel is booting\n");
     printf("\n");
     kinit();         // physical page allocator
+    slabinit();      // slab allocator
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
@@ -27,6 +28,10 @@ main()
     binit();         // buffer cache
     iinit();         // inode table
     fileinit();      // file table
+    pipeinit();      // pipe cache
+    pcacheinit();    // exec page cache
+    shminit();       // shared memory objects
+    swapinit();      // swap area
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
     __sync_synchronize();
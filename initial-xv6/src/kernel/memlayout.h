@@ -27,6 +27,7 @@
 
 // core local interruptor (CLINT), which contains the timer.
 #define CLINT 0x2000000L
+#define CLINT_MSIP(hartid) (CLINT + 4*(hartid)) // software interrupt
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
 
@@ -62,10 +63,20 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   mmap regions, allocated downwards from MMAPTOP
+//   ...
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
 
+// the heap may not grow past MMAPBASE. Both ends are 2MB
+// aligned, so heap and mmap pages never share a leaf
+// page-table page.
+#define MMAPBASE (MAXVA / 4)
+#define MMAPTOP (MAXVA / 2)
+
 
 #define PTE_COW (1L << 8)  // Assign an unused bit for COW
+#define PTE_MEGA (1L << 9) // level-1 leaf mapping a 2MB megapage
+#define PTE_SWAP (1L << 5) // with PTE_V clear: page is in swap (see swap.c)
 
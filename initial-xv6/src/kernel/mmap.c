@@ -0,0 +1,390 @@
+// Memory-mapped files and anonymous memory.
+//
+// mmap() only records a region in p->vma[]; vmafault() maps
+// each page when it is first touched. File pages come from the
+// page cache (pagecache.c), so every process mapping a page of a
+// file shared uses the same physical page, and a private
+// read-only page costs no copy until it is written. Anonymous
+// shared pages come from a shm object (shm.c); anonymous private
+// ones are zero-filled like the heap.
+//
+// A MAP_SHARED region writes its dirty pages (PTE_D) back to the
+// file when it is unmapped, including by exit() and exec(). The
+// write drops the file's pages from the page cache, so a process
+// that maps a page for the first time after that reads it from
+// the file again rather than sharing the existing copy.
+//
+// fork() copies the regions: shared pages stay shared and
+// writable, private ones become copy-on-write (see uvmcopyvma()).
+// The child's regions refer to the same files and shm objects,
+// so pages first touched after the fork are shared as well.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "defs.h"
+
+// Return p's mmap region containing va, or 0 if none.
+struct vma *
+findvma(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->addr && va >= v->addr && va < v->addr + v->len)
+      return v;
+  }
+  return 0;
+}
+
+// Does [addr, addr+len) overlap one of p's regions?
+static int
+vmaoverlap(struct proc *p, uint64 addr, uint64 len)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->addr && addr < v->addr + v->len && v->addr < addr + len)
+      return 1;
+  }
+  return 0;
+}
+
+// Find len free bytes for a new region, as high as possible
+// below MMAPTOP. Returns 0 if there is no room.
+static uint64
+vmaspace(struct proc *p, uint64 len)
+{
+  struct vma *v;
+  uint64 a = MMAPTOP - len;
+
+ again:
+  if(a < MMAPBASE)
+    return 0;
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->addr && a < v->addr + v->len && v->addr < a + len){
+      a = v->addr - len;
+      goto again;
+    }
+  }
+  return a;
+}
+
+// Drop region v's references to its file or shm object.
+static void
+vmaclose(struct vma *v)
+{
+  if(v->f)
+    fileclose(v->f);
+  if(v->shm)
+    shmput(v->shm);
+  v->addr = 0;
+}
+
+// Take references to v's file or shm object for a copy of v.
+static void
+vmadup(struct vma *v)
+{
+  if(v->f)
+    filedup(v->f);
+  if(v->shm)
+    shmdup(v->shm);
+}
+
+// Map len bytes of f from offset off into the current process,
+// or with MAP_ANONYMOUS len bytes of zeroes (f and off unused).
+// addr is a hint, used if it is free and page-aligned.
+// Returns the address of the region, or -1.
+uint64
+mmap(uint64 addr, uint64 len, int prot, int flags, struct file *f, uint off)
+{
+  struct proc *p = myproc();
+  struct shm *shm = 0;
+  struct vma *v;
+  int type = flags & ~MAP_ANONYMOUS;
+
+  if(len == 0 || len > MMAPTOP - MMAPBASE || off % PGSIZE != 0)
+    return -1;
+  if(type != MAP_SHARED && type != MAP_PRIVATE)
+    return -1;
+  if(flags & MAP_ANONYMOUS){
+    f = 0;
+    off = 0;
+  } else {
+    if(f->type != FD_INODE || !f->readable)
+      return -1;
+    if(type == MAP_SHARED && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+  }
+  len = PGROUNDUP(len);
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->addr == 0)
+      break;
+  }
+  if(v == &p->vma[NVMA])
+    return -1;
+
+  if(addr % PGSIZE != 0 || addr < MMAPBASE || addr > MMAPTOP - len ||
+     vmaoverlap(p, addr, len))
+    addr = vmaspace(p, len);
+  if(addr == 0)
+    return -1;
+  if(f == 0 && type == MAP_SHARED && (shm = shmalloc(len / PGSIZE)) == 0)
+    return -1;
+
+  v->addr = addr;
+  v->len = len;
+  v->prot = prot;
+  v->flags = flags;
+  v->f = f ? filedup(f) : 0;
+  v->shm = shm;
+  v->off = off;
+  return addr;
+}
+
+// Return the page of file region v at va, with a reference
+// taken for the caller. A private page that is being written is
+// a copy of its own; otherwise it is the page cache's page.
+// Touching a page wholly past the end of the file is an error.
+// Returns 0 on failure.
+static uint64
+filepage(struct vma *v, uint64 va, int write)
+{
+  struct inode *ip = v->f->ip;
+  uint off = v->off + (va - v->addr);
+  int cached = (v->flags & MAP_SHARED) || !write;
+  uint64 pa;
+  char *mem;
+  uint n;
+
+  ilock(ip);
+
+  if(off >= ip->size)
+    goto bad;
+  n = ip->size - off < PGSIZE ? ip->size - off : PGSIZE;
+
+  pa = 0;
+  if(cached)
+    pa = pcache_get(ip, off, n);
+  if(pa == 0){
+    if((mem = ualloc()) == 0)
+      goto bad;
+    memset(mem + n, 0, PGSIZE - n);
+    if(readi(ip, 0, (uint64)mem, off, n) != n){
+      kfree(mem);
+      goto bad;
+    }
+    pa = (uint64)mem;
+    if(cached){
+      pa = pcache_put(ip, off, n, pa);
+      if(pa != (uint64)mem)
+        kfree(mem);
+    }
+  }
+
+  iunlock(ip);
+  return pa;
+
+ bad:
+  iunlock(ip);
+  return 0;
+}
+
+// Return a page for anonymous private memory, with a reference
+// taken for the caller: the shared zero page for a read, or a
+// zeroed page of its own for a write. Returns 0 on failure.
+static uint64
+anonpage(int write)
+{
+  char *mem;
+
+  if(!write){
+    incref((uint64)zeropage);
+    return (uint64)zeropage;
+  }
+  if((mem = ualloc()) == 0)
+    return 0;
+  pagezero(mem);
+  return (uint64)mem;
+}
+
+// Map in the page of region v at va, which is not mapped.
+// Shared pages, and private pages that were just copied for a
+// write, are mapped writable if the region is; other private
+// pages copy-on-write. Returns 0 on success, -1 on failure.
+int
+vmafault(struct proc *p, struct vma *v, uint64 va, int write)
+{
+  int perm = PTE_R | PTE_U;
+  uint64 pa;
+
+  if(write && (v->prot & PROT_WRITE) == 0)
+    return -1;
+
+  if(v->shm)
+    pa = shmpage(v->shm, (v->off + (va - v->addr)) / PGSIZE);
+  else if(v->f)
+    pa = filepage(v, va, write);
+  else
+    pa = anonpage(write);
+  if(pa == 0)
+    return -1;
+
+  if(v->prot & PROT_WRITE){
+    if((v->flags & MAP_SHARED) || write)
+      perm |= PTE_W;
+    else
+      perm |= PTE_COW;
+  }
+  if(mappages(p->pagetable, va, PGSIZE, pa, perm) != 0){
+    kfree((void*)pa);
+    return -1;
+  }
+  return 0;
+}
+
+// Write the dirty pages of region v in [start, end) back to its
+// file, if it is a shared, writable file region. Only the part
+// of each page inside the file is written; a mapping cannot
+// grow its file.
+// Must not be called inside a file system transaction.
+static void
+vmawriteback(struct proc *p, struct vma *v, uint64 start, uint64 end)
+{
+  struct inode *ip;
+  uint64 va;
+  pte_t *pte;
+  uint off, n;
+
+  if(v->f == 0 || (v->flags & MAP_SHARED) == 0 || (v->prot & PROT_WRITE) == 0)
+    return;
+
+  ip = v->f->ip;
+  for(va = start; va < end; va += PGSIZE){
+    if((pte = walk(p->pagetable, va, 0)) == 0)
+      continue;
+    if((*pte & PTE_V) == 0 || (*pte & PTE_D) == 0)
+      continue;
+    off = v->off + (va - v->addr);
+    // one page per transaction keeps within MAXOPBLOCKS.
+    begin_op();
+    ilock(ip);
+    if(off < ip->size){
+      n = ip->size - off < PGSIZE ? ip->size - off : PGSIZE;
+      writeipage(ip, PTE2PA(*pte), off, n);
+    }
+    iunlock(ip);
+    end_op();
+  }
+}
+
+// Write back and unmap [start, end) of region v.
+static void
+vmaunmap(struct proc *p, struct vma *v, uint64 start, uint64 end)
+{
+  vmawriteback(p, v, start, end);
+  uvmunmap(p->pagetable, start, (end - start) / PGSIZE, 1);
+}
+
+// Unmap [addr, addr+len) from the current process. The range may
+// cover any part of any regions; unmapping the middle of a region
+// splits it in two. Returns 0 on success, -1 on failure.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v, *nv = 0;
+  uint64 end, vend, s, e;
+
+  if(addr % PGSIZE != 0 || len == 0)
+    return -1;
+  end = addr + PGROUNDUP(len);
+  if(end < addr)
+    return -1;
+
+  // a hole in the middle of a region needs a free slot.
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->addr && addr > v->addr && end < v->addr + v->len){
+      for(nv = p->vma; nv < &p->vma[NVMA]; nv++){
+        if(nv->addr == 0)
+          break;
+      }
+      if(nv == &p->vma[NVMA])
+        return -1;
+    }
+  }
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->addr == 0 || v == nv)
+      continue;
+    vend = v->addr + v->len;
+    if(end <= v->addr || addr >= vend)
+      continue;
+    s = addr > v->addr ? addr : v->addr;
+    e = end < vend ? end : vend;
+    vmaunmap(p, v, s, e);
+
+    if(s == v->addr && e == vend){
+      vmaclose(v);
+    } else if(s == v->addr){
+      v->off += e - v->addr;
+      v->addr = e;
+      v->len = vend - e;
+    } else if(e == vend){
+      v->len = s - v->addr;
+    } else {
+      *nv = *v;
+      nv->addr = e;
+      nv->len = vend - e;
+      nv->off = v->off + (e - v->addr);
+      vmadup(nv);
+      v->len = s - v->addr;
+    }
+  }
+  return 0;
+}
+
+// Unmap all of p's regions, for exit() and exec().
+// Must not be called inside a file system transaction.
+void
+vmaunmapall(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->addr){
+      vmaunmap(p, v, v->addr, v->addr + v->len);
+      vmaclose(v);
+    }
+  }
+}
+
+// Give fork()'s child np copies of p's regions and their pages.
+// Returns 0 on success, -1 on failure; on failure np has no
+// regions, and whatever was mapped is left for uvmfree().
+int
+vmacopy(struct proc *np, struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->addr &&
+       uvmcopyvma(p->pagetable, np->pagetable, v->addr, v->len,
+                  v->flags & MAP_SHARED) < 0)
+      return -1;
+  }
+  for(int i = 0; i < NVMA; i++){
+    np->vma[i] = p->vma[i];
+    if(np->vma[i].addr)
+      vmadup(&np->vma[i]);
+  }
+  return 0;
+}
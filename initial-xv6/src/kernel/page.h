@@ -0,0 +1,16 @@
+// Metadata for one physical page managed by kalloc.c.
+// There is one entry per page in [kmem.base, PHYSTOP); see pa2page().
+struct page {
+  int refcnt;   // mappings and kernel users of this page
+  ushort flags; // PG_* below
+  ushort order; // PG_BUDDY: the free block is 2^order pages
+  // future per-page state (LRU linkage, owner) goes here.
+};
+
+#define PG_FREE (1 << 0) // on a free list
+#define PG_PTRO (1 << 1) // leaf page table with no writable PTEs
+#define PG_HUGE (1 << 2) // first page of an unsplit 2MB page;
+                         // its refcnt counts the whole 2MB
+#define PG_BUDDY (1 << 3) // first page of a free block on a buddy list
+
+#define MEGAORDER 9      // a 2MB page is a block of 2^9 pages
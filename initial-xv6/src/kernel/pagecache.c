@@ -0,0 +1,187 @@
+// Page cache for read-only pages of executables and for
+// mmap()ed files.
+//
+// Demand-paged exec (see segfault() in exec.c) reads text pages
+// in on first touch. Caching them by (dev, inum, file offset)
+// lets later execs of the same binary, e.g. sh spawning ls,
+// grep and cat over and over, map the same physical pages
+// read-only at exec time instead of reading and copying them
+// again, so every process running a binary shares one copy.
+// mmap.c maps the same pages, writably for MAP_SHARED.
+//
+// The cache holds one reference to each of its pages; every
+// mapping holds another. Dropping a page from the cache does
+// not disturb them, but a process that maps the same page
+// afterwards would get a fresh copy of it and stop seeing
+// their MAP_SHARED writes, so eviction only takes pages nobody
+// maps; if every entry is mapped, a new page goes uncached.
+// kalloc() drops all unmapped pages from the cache when it
+// runs out of memory.
+//
+// Cached pages go stale if the file changes, so writei() and
+// itrunc() drop a file's pages, as does iget() when it recycles
+// the file's in-memory inode. Writing a MAP_SHARED page back
+// uses writeipage() instead, which leaves them alone. ip->pcached records whether a
+// file may have pages here, so that this is cheap for the
+// common case of files that are never executed.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "defs.h"
+
+#define NPCBUCKET 61
+
+struct pcentry {
+  uint dev;
+  uint inum;
+  uint off;             // file offset of the page
+  uint len;             // bytes read from the file; rest are zero
+  uint64 pa;            // 0 if the entry is unused
+  struct pcentry *next; // hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct pcentry entry[NPCACHE];
+  struct pcentry *bucket[NPCBUCKET];
+  int hand;             // next entry to evict
+} pcache;
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+}
+
+static struct pcentry **
+pcbucket(uint dev, uint inum, uint off)
+{
+  return &pcache.bucket[(dev * 31 + inum * 131 + off / PGSIZE) % NPCBUCKET];
+}
+
+// Unlink e from its hash chain and drop the cache's reference.
+// Caller must hold pcache.lock.
+static void
+pcremove(struct pcentry *e)
+{
+  struct pcentry **pp;
+
+  for(pp = pcbucket(e->dev, e->inum, e->off); *pp; pp = &(*pp)->next){
+    if(*pp == e){
+      *pp = e->next;
+      break;
+    }
+  }
+  kfree((void*)e->pa);
+  e->pa = 0;
+}
+
+// Look up the page at file offset off of ip, holding len bytes
+// of file data. Returns its physical address with a reference
+// taken for the caller, or 0 if it is not cached.
+uint64
+pcache_get(struct inode *ip, uint off, uint len)
+{
+  struct pcentry *e;
+  uint64 pa = 0;
+
+  acquire(&pcache.lock);
+  for(e = *pcbucket(ip->dev, ip->inum, off); e; e = e->next){
+    if(e->dev == ip->dev && e->inum == ip->inum && e->off == off && e->len == len){
+      pa = e->pa;
+      incref(pa);
+      break;
+    }
+  }
+  release(&pcache.lock);
+  return pa;
+}
+
+// Offer pa, a freshly read copy of the page at file offset
+// off of ip, to the cache. The caller's reference to pa is
+// untouched. If another process cached the same page first,
+// returns that page with a reference taken for the caller,
+// who should then free pa; otherwise returns pa, which the
+// cache may or may not have kept.
+// Caller must hold ip->lock.
+uint64
+pcache_put(struct inode *ip, uint off, uint len, uint64 pa)
+{
+  struct pcentry *e, **bp;
+  int i;
+
+  acquire(&pcache.lock);
+  bp = pcbucket(ip->dev, ip->inum, off);
+  for(e = *bp; e; e = e->next){
+    if(e->dev == ip->dev && e->inum == ip->inum && e->off == off && e->len == len){
+      incref(e->pa);
+      release(&pcache.lock);
+      return e->pa;
+    }
+  }
+
+  // take the next entry round that is free or unmapped.
+  for(i = 0; i < NPCACHE; i++){
+    e = &pcache.entry[pcache.hand];
+    pcache.hand = (pcache.hand + 1) % NPCACHE;
+    if(e->pa == 0 || getref(e->pa) == 1)
+      break;
+  }
+  if(i == NPCACHE){
+    // all mapped: leave pa to the caller alone.
+    release(&pcache.lock);
+    return pa;
+  }
+  if(e->pa)
+    pcremove(e);
+
+  e->dev = ip->dev;
+  e->inum = ip->inum;
+  e->off = off;
+  e->len = len;
+  e->pa = pa;
+  incref(pa);
+  e->next = *bp;
+  *bp = e;
+  ip->pcached = 1;
+  release(&pcache.lock);
+  return pa;
+}
+
+// Drop every cached page of file (dev, inum).
+void
+pcache_invalidate(uint dev, uint inum)
+{
+  struct pcentry *e;
+
+  acquire(&pcache.lock);
+  for(e = pcache.entry; e < &pcache.entry[NPCACHE]; e++){
+    if(e->pa && e->dev == dev && e->inum == inum)
+      pcremove(e);
+  }
+  release(&pcache.lock);
+}
+
+// Drop every cached page that no process maps, to make
+// memory available. Returns the number of pages freed.
+int
+pcache_reclaim(void)
+{
+  struct pcentry *e;
+  int n = 0;
+
+  acquire(&pcache.lock);
+  for(e = pcache.entry; e < &pcache.entry[NPCACHE]; e++){
+    if(e->pa && getref(e->pa) == 1){
+      pcremove(e);
+      n++;
+    }
+  }
+  release(&pcache.lock);
+  return n;
+}
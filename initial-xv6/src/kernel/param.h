@@ -1,8 +1,7 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // in-memory i-nodes kept cached
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
@@ -11,3 +10,11 @@
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#define NEXECSEG       4   // lazily loaded ELF segments per process
+#define NPCACHE      256   // pages in the exec page cache
+#define MAXORDER      10   // largest free block is 2^MAXORDER pages
+#define NVMA          16   // mmap regions per process
+#define NSHM          32   // anonymous shared memory objects
+#define SHMMAXPAGES  512   // pages per shared memory object
+#define NSWAPBLOCK  8192   // swap blocks on the disk, after the file system
+#define TICKCYCLES 1000000 // timer cycles per tick; about 1/10th second in qemu
@@ -13,6 +13,78 @@ struct proc proc[NPROC];
 
 struct proc *initproc;
 
+// Per-CPU run queues of RUNNABLE processes, first in first out.
+// A process that becomes RUNNABLE goes on the queue of the CPU
+// it last ran on, or for a new process the CPU that made it, so
+// scheduler() looks only at its own queue instead of locking
+// every process in turn. A CPU whose queue is empty steals the
+// head of another's.
+//
+// Lock order: p->lock, then a queue's lock. scheduler() takes a
+// process off a queue without holding p->lock, which is safe
+// because only RUNNABLE processes are on queues and only
+// scheduler() changes that state.
+//
+// Under SCHED_MLFQ each run queue has NQUEUE levels, and a
+// CPU runs the head of its highest non-empty level. A process
+// that uses up the time slice of its level drops a level, and
+// every MLFQBOOST ticks all processes go back to level 0.
+//
+// Under SCHED_STRIDE and SCHED_LOTTERY a process gets CPU time
+// in proportion to its tickets. Shares are of the whole machine,
+// so every CPU takes from the one queue, runq[0]. Stride keeps
+// the queue as a min-heap on pass, and each tick a process runs
+// adds its stride, STRIDE1 / tickets, to its pass. Lottery keeps
+// it unordered and draws a ticket.
+struct runq
+{
+  struct spinlock lock;
+#ifdef SCHED_SHARE
+  struct proc *heap[NPROC]; // STRIDE: min-heap; LOTTERY: any order
+  uint64 pass;  // STRIDE: pass of the process last taken
+  int tickets;  // LOTTERY: sum of the queue's tickets
+  uint seed;    // LOTTERY: random number state
+#else
+  struct
+  {
+    struct proc *head;
+    struct proc *tail;
+  } q[NQUEUE];
+#endif
+  int n; // processes on the queue
+} __attribute__((aligned(64)));
+
+struct runq runq[NCPU];
+
+// Sleeping processes, on lists hashed by wait channel, so that
+// wakeup() looks only at those that might be sleeping on chan.
+// A process puts itself on its list in sleep(), and takes itself
+// off once it wakes; wakeup() and kill() only make it RUNNABLE.
+// Lock order: a list's lock, then p->lock.
+#define NWAITQ 64
+struct waitq
+{
+  struct spinlock lock;
+  struct proc *head;
+} waitq[NWAITQ];
+
+static struct waitq *
+waitqof(void *chan)
+{
+  return &waitq[((uint64)chan * 0x9e3779b97f4a7c15ULL) >> 58];
+}
+
+#ifdef SCHED_SHARE
+#define rqof(p) (&runq[0])
+#else
+#define rqof(p) (&runq[(p)->cpu])
+#endif
+
+#ifdef SCHED_MLFQ
+// Ticks a process may run at each level before it drops.
+static int mlfqslice[NQUEUE] = {1, 3, 9, 15};
+#endif
+
 int nextpid = 1;
 struct spinlock pid_lock;
 
@@ -54,6 +126,15 @@ void procinit(void)
 
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  for (int i = 0; i < NWAITQ; i++)
+    initlock(&waitq[i].lock, "waitq");
+  for (int i = 0; i < NCPU; i++)
+  {
+    initlock(&runq[i].lock, "runq");
+#ifdef SCHED_LOTTERY
+    runq[i].seed = 2463534242 + i;
+#endif
+  }
   for (p = proc; p < &proc[NPROC]; p++)
   {
     initlock(&p->lock, "proc");
@@ -104,6 +185,186 @@ int allocpid()
   return pid;
 }
 
+// rqput() adds p to rq, and rqtake() takes the process that
+// should run next off a non-empty rq. Caller must hold rq->lock.
+#if defined(SCHED_STRIDE)
+static void
+rqput(struct runq *rq, struct proc *p)
+{
+  int i = rq->n++;
+
+  // A process that slept does not get to catch up on the
+  // time it was not asking for.
+  if (p->pass < rq->pass)
+    p->pass = rq->pass;
+  while (i > 0 && rq->heap[(i - 1) / 2]->pass > p->pass)
+  {
+    rq->heap[i] = rq->heap[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  rq->heap[i] = p;
+}
+
+static struct proc *
+rqtake(struct runq *rq)
+{
+  struct proc *p = rq->heap[0];
+  struct proc *last = rq->heap[--rq->n];
+  int i = 0, c;
+
+  for (;;)
+  {
+    c = 2 * i + 1;
+    if (c >= rq->n)
+      break;
+    if (c + 1 < rq->n && rq->heap[c + 1]->pass < rq->heap[c]->pass)
+      c++;
+    if (rq->heap[c]->pass >= last->pass)
+      break;
+    rq->heap[i] = rq->heap[c];
+    i = c;
+  }
+  rq->heap[i] = last;
+  rq->pass = p->pass;
+  return p;
+}
+#elif defined(SCHED_LOTTERY)
+static void
+rqput(struct runq *rq, struct proc *p)
+{
+  rq->heap[rq->n++] = p;
+  rq->tickets += p->tickets;
+}
+
+static struct proc *
+rqtake(struct runq *rq)
+{
+  struct proc *p;
+  int i, win;
+
+  // xorshift32
+  rq->seed ^= rq->seed << 13;
+  rq->seed ^= rq->seed >> 17;
+  rq->seed ^= rq->seed << 5;
+  win = rq->seed % rq->tickets;
+  for (i = 0; win >= rq->heap[i]->tickets; i++)
+    win -= rq->heap[i]->tickets;
+  p = rq->heap[i];
+  rq->heap[i] = rq->heap[--rq->n];
+  rq->tickets -= p->tickets;
+  return p;
+}
+#else
+static void
+rqput(struct runq *rq, struct proc *p)
+{
+  int l = p->level;
+
+  p->rqnext = 0;
+  if (rq->q[l].tail)
+    rq->q[l].tail->rqnext = p;
+  else
+    rq->q[l].head = p;
+  rq->q[l].tail = p;
+  rq->n++;
+}
+
+static struct proc *
+rqtake(struct runq *rq)
+{
+  struct proc *p;
+  int l = 0;
+
+  while (rq->q[l].head == 0)
+    l++;
+  p = rq->q[l].head;
+  rq->q[l].head = p->rqnext;
+  if (rq->q[l].head == 0)
+    rq->q[l].tail = 0;
+  rq->n--;
+  return p;
+}
+#endif
+
+// Wake an idle CPU to run work just queued for cpu: cpu itself
+// if it is idle, else any idle CPU, which will steal it.
+static void
+kickidle(int cpu)
+{
+  // Pairs with the barrier in idle().
+  __sync_synchronize();
+  if (!cpus[cpu].idle)
+  {
+    for (cpu = 0; cpu < NCPU && !cpus[cpu].idle; cpu++)
+      ;
+    if (cpu == NCPU)
+      return;
+  }
+  ipi(cpu);
+}
+
+// Make p RUNNABLE and put it on its run queue.
+// Caller must hold p->lock.
+static void
+setrunnable(struct proc *p)
+{
+  struct runq *rq = rqof(p);
+
+  p->state = RUNNABLE;
+  acquire(&rq->lock);
+  rqput(rq, p);
+  release(&rq->lock);
+  // A yield()ing process is about to be taken by its own CPU.
+  if (p != myproc())
+    kickidle(p->cpu);
+}
+
+// Take the next process to run off rq, or return 0 if rq is
+// empty. Looks before locking, so that idle CPUs do not
+// contend for the locks of empty queues.
+static struct proc *
+rqget(struct runq *rq)
+{
+  struct proc *p = 0;
+
+  if (__atomic_load_n(&rq->n, __ATOMIC_RELAXED) == 0)
+    return 0;
+  acquire(&rq->lock);
+  if (rq->n > 0)
+    p = rqtake(rq);
+  release(&rq->lock);
+  return p;
+}
+
+// Is any process waiting on a run queue?
+static int
+anywork(void)
+{
+  for (int i = 0; i < NCPU; i++)
+    if (__atomic_load_n(&runq[i].n, __ATOMIC_RELAXED))
+      return 1;
+  return 0;
+}
+
+// Nothing to run: wait for an interrupt with wfi rather than
+// spin, with the timer armed only if this CPU has a deadline to
+// keep. setrunnable() sends an ipi() to an idle CPU when it
+// queues work. Interrupts stay off until after wfi, so one
+// that comes after the check below still wakes it.
+static void
+idle(struct cpu *c)
+{
+  intr_off();
+  c->idle = 1;
+  __sync_synchronize();
+  timerarm();
+  if (!anywork())
+    wfi();
+  c->idle = 0;
+  // Time may have passed with no CPU taking ticks.
+  clockintr();
+}
+
 // Look in the process table for an UNUSED proc.
 // If found, initialize state required to run in the kernel,
 // and return with p->lock held.
@@ -130,6 +391,18 @@ allocproc(void)
 found:
   p->pid = allocpid();
   p->state = USED;
+  p->cpu = cpuid(); // interrupts are off while we hold p->lock
+  p->level = 0;
+  p->slice = 0;
+  p->tqidx = -1;
+  p->tickets = DEFTICKETS;
+  p->stride = STRIDE1 / DEFTICKETS;
+  p->pass = 0;
+
+  // The ASID is the slot's, so every hart may hold entries
+  // for it left by the slot's last process.
+  p->asid = asidmax >= NPROC ? (p - proc) + 1 : 0;
+  p->tlbstale = TLB_ALLHARTS;
 
   // Allocate a trapframe page.
   if ((p->trapframe = (struct trapframe *)kalloc()) == 0)
@@ -178,6 +451,7 @@ freeproc(struct proc *p)
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->hugeheap = 0;
   p->state = UNUSED;
 }
 
@@ -258,7 +532,7 @@ void userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
 
   release(&p->lock);
 }
@@ -273,10 +547,11 @@ int growproc(int n)
   sz = p->sz;
   if (n > 0)
   {
-    if ((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0)
-    {
+    // Only reserve the address range; handle_lazy_fault()
+    // allocates each page when it is first touched.
+    if (sz + n > MMAPBASE)
       return -1;
-    }
+    sz += n;
   }
   else if (n < 0)
   {
@@ -307,7 +582,18 @@ int fork(void)
     release(&np->lock);
     return -1;
   }
+  if (vmacopy(np, p) < 0)
+  {
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
   np->sz = p->sz;
+  np->hugeheap = p->hugeheap;
+  np->tickets = p->tickets;
+  np->stride = p->stride;
+  np->pass = p->pass;
+  execsegdup(np, p);
 
   // Copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -332,7 +618,62 @@ int fork(void)
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  setrunnable(np);
+  release(&np->lock);
+
+  return pid;
+}
+
+// Create a new process running the program path with
+// arguments argv, built straight from the executable instead
+// of by copying the caller's address space as fork() does.
+// The child's descriptors 0, 1 and 2 are the caller's
+// descriptors fds[0], fds[1] and fds[2], or closed where
+// those are -1; it inherits no other descriptors.
+// Returns the child's pid, or -1.
+int spawn(char *path, char **argv, int *fds)
+{
+  int i, pid, argc;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  for (i = 0; i < 3; i++)
+    if (fds[i] != -1 && (fds[i] < 0 || fds[i] >= NOFILE || p->ofile[fds[i]] == 0))
+      return -1;
+
+  if ((np = allocproc()) == 0)
+    return -1;
+  // Loading the program sleeps; nothing else touches a USED
+  // process without a parent.
+  release(&np->lock);
+
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+  if ((argc = execproc(np, path, argv)) < 0)
+  {
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  // execproc() set the stack pointer, argv and entry point.
+  np->trapframe->a0 = argc;
+  np->tickets = p->tickets;
+  np->stride = p->stride;
+  np->pass = p->pass;
+
+  for (i = 0; i < 3; i++)
+    if (fds[i] != -1)
+      np->ofile[i] = filedup(p->ofile[fds[i]]);
+  np->cwd = idup(p->cwd);
+
+  pid = np->pid;
+
+  acquire(&wait_lock);
+  np->parent = p;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  setrunnable(np);
   release(&np->lock);
 
   return pid;
@@ -375,6 +716,9 @@ void exit(int status)
     }
   }
 
+  vmaunmapall(p);
+  execsegput(p->seg);
+
   begin_op();
   iput(p->cwd);
   end_op();
@@ -411,9 +755,14 @@ void exit(int status)
 int wait(uint64 addr)
 {
   struct proc *pp;
-  int havekids, pid;
+  int havekids, pid, xstate;
   struct proc *p = myproc();
 
+  // Fault in addr before reaping anything, so that a bad
+  // address leaves the child to be waited for again.
+  if (addr != 0 && ufault(addr, sizeof(xstate), 1) < sizeof(xstate))
+    return -1;
+
   acquire(&wait_lock);
 
   for (;;)
@@ -432,16 +781,15 @@ int wait(uint64 addr)
         {
           // Found one.
           pid = pp->pid;
-          if (addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                   sizeof(pp->xstate)) < 0)
-          {
-            release(&pp->lock);
-            release(&wait_lock);
-            return -1;
-          }
+          xstate = pp->xstate;
           freeproc(pp);
           release(&pp->lock);
           release(&wait_lock);
+          // copy out only after dropping the locks, since
+          // addr may have been swapped out while we slept.
+          if (addr != 0 && copyout(p->pagetable, addr, (char *)&xstate,
+                                   sizeof(xstate)) < 0)
+            return -1;
           return pid;
         }
         release(&pp->lock);
@@ -471,6 +819,7 @@ void scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = c - cpus;
 
   c->proc = 0;
   for (;;)
@@ -478,24 +827,34 @@ void scheduler(void)
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    for (p = proc; p < &proc[NPROC]; p++)
+    // Our own run queue first, then steal from the others,
+    // starting with our neighbour so that idle CPUs spread out.
+    p = rqget(&runq[id]);
+    for (int i = 1; p == 0 && i < NCPU; i++)
+      p = rqget(&runq[(id + i) % NCPU]);
+    if (p == 0)
     {
-      acquire(&p->lock);
-      if (p->state == RUNNABLE)
-      {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&p->lock);
+      idle(c);
+      continue;
     }
+
+    acquire(&p->lock);
+    if (p->state != RUNNABLE)
+      panic("scheduler: not runnable");
+
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    p->cpu = id;
+    c->proc = p;
+    timerarm();
+    swtch(&c->context, &p->context);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -525,12 +884,108 @@ void sched(void)
   mycpu()->intena = intena;
 }
 
+// Called on a timer interrupt from user space. Returns 1 if p,
+// the current process, should give up the CPU.
+int timeslice(struct proc *p)
+{
+#ifdef SCHED_MLFQ
+  int preempt = 0;
+
+  acquire(&p->lock);
+  // Ticks used are kept across sleeps, so a process cannot stay
+  // on top by sleeping just before its slice runs out.
+  if (++p->slice >= mlfqslice[p->level])
+  {
+    if (p->level < NQUEUE - 1)
+      p->level++;
+    p->slice = 0;
+    preempt = 1;
+  }
+  else
+  {
+    // Make way for a process of a higher level on this CPU.
+    for (int l = 0; l < p->level; l++)
+      if (__atomic_load_n(&runq[p->cpu].q[l].head, __ATOMIC_RELAXED))
+        preempt = 1;
+  }
+  release(&p->lock);
+  return preempt;
+#else
+#ifdef SCHED_STRIDE
+  acquire(&p->lock);
+  p->pass += p->stride;
+  release(&p->lock);
+#endif
+  return 1;
+#endif
+}
+
+// Give the current process n tickets, for a share of the CPU
+// in proportion to them under SCHED_STRIDE and SCHED_LOTTERY.
+int settickets(int n)
+{
+  struct proc *p = myproc();
+
+  if (n < 1 || n > STRIDE1)
+    return -1;
+  acquire(&p->lock);
+  p->tickets = n;
+  p->stride = STRIDE1 / n;
+  release(&p->lock);
+  return 0;
+}
+
+#ifdef SCHED_MLFQ
+// Move every process back to level 0, so that processes that
+// have sunk to the bottom are not starved by a stream of
+// interactive ones. A process that changes state while this
+// runs may miss the boost, and get the next one.
+void mlfqboost(void)
+{
+  struct proc *p;
+  struct runq *rq;
+
+  for (p = proc; p < &proc[NPROC]; p++)
+  {
+    acquire(&p->lock);
+    if (p->state != UNUSED && p->state != RUNNABLE)
+    {
+      p->level = 0;
+      p->slice = 0;
+    }
+    release(&p->lock);
+  }
+
+  for (rq = runq; rq < &runq[NCPU]; rq++)
+  {
+    acquire(&rq->lock);
+    for (int l = 1; l < NQUEUE; l++)
+    {
+      if (rq->q[l].head == 0)
+        continue;
+      for (p = rq->q[l].head; p; p = p->rqnext)
+      {
+        p->level = 0;
+        p->slice = 0;
+      }
+      if (rq->q[0].tail)
+        rq->q[0].tail->rqnext = rq->q[l].head;
+      else
+        rq->q[0].head = rq->q[l].head;
+      rq->q[0].tail = rq->q[l].tail;
+      rq->q[l].head = rq->q[l].tail = 0;
+    }
+    release(&rq->lock);
+  }
+}
+#endif
+
 // Give up the CPU for one scheduling round.
 void yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  setrunnable(p);
   sched();
   release(&p->lock);
 }
@@ -561,6 +1016,7 @@ void forkret(void)
 void sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct waitq *wq = waitqof(chan);
 
   // Must acquire p->lock in order to
   // change p->state and then call sched.
@@ -568,8 +1024,16 @@ void sleep(void *chan, struct spinlock *lk)
   // guaranteed that we won't miss any wakeup
   // (wakeup locks p->lock),
   // so it's okay to release lk.
+  // Get on chan's list first, where wakeup() looks.
 
+  acquire(&wq->lock);
   acquire(&p->lock); // DOC: sleeplock1
+  p->wprev = 0;
+  p->wnext = wq->head;
+  if (wq->head)
+    wq->head->wprev = p;
+  wq->head = p;
+  release(&wq->lock);
   release(lk);
 
   // Go to sleep.
@@ -580,9 +1044,18 @@ void sleep(void *chan, struct spinlock *lk)
 
   // Tidy up.
   p->chan = 0;
+  release(&p->lock);
+
+  acquire(&wq->lock);
+  if (p->wprev)
+    p->wprev->wnext = p->wnext;
+  else
+    wq->head = p->wnext;
+  if (p->wnext)
+    p->wnext->wprev = p->wprev;
+  release(&wq->lock);
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
 }
 
@@ -590,20 +1063,23 @@ void sleep(void *chan, struct spinlock *lk)
 // Must be called without any p->lock.
 void wakeup(void *chan)
 {
+  struct waitq *wq = waitqof(chan);
   struct proc *p;
 
-  for (p = proc; p < &proc[NPROC]; p++)
+  acquire(&wq->lock);
+  for (p = wq->head; p; p = p->wnext)
   {
     if (p != myproc())
     {
       acquire(&p->lock);
       if (p->state == SLEEPING && p->chan == chan)
       {
-        p->state = RUNNABLE;
+        setrunnable(p);
       }
       release(&p->lock);
     }
   }
+  release(&wq->lock);
 }
 
 // Kill the process with the given pid.
@@ -622,7 +1098,7 @@ int kill(int pid)
       if (p->state == SLEEPING)
       {
         // Wake process from sleep().
-        p->state = RUNNABLE;
+        setrunnable(p);
       }
       release(&p->lock);
       return 0;
@@ -716,9 +1192,14 @@ void procdump(void)
 int waitx(uint64 addr, uint *wtime, uint *rtime)
 {
   struct proc *np;
-  int havekids, pid;
+  int havekids, pid, xstate;
   struct proc *p = myproc();
 
+  // Fault in addr before reaping anything, so that a bad
+  // address leaves the child to be waited for again.
+  if (addr != 0 && ufault(addr, sizeof(xstate), 1) < sizeof(xstate))
+    return -1;
+
   acquire(&wait_lock);
 
   for (;;)
@@ -739,16 +1220,15 @@ int waitx(uint64 addr, uint *wtime, uint *rtime)
           pid = np->pid;
           *rtime = np->rtime;
           *wtime = np->etime - np->ctime - np->rtime;
-          if (addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
-                                   sizeof(np->xstate)) < 0)
-          {
-            release(&np->lock);
-            release(&wait_lock);
-            return -1;
-          }
+          xstate = np->xstate;
           freeproc(np);
           release(&np->lock);
           release(&wait_lock);
+          // copy out only after dropping the locks, since
+          // addr may have been swapped out while we slept.
+          if (addr != 0 && copyout(p->pagetable, addr, (char *)&xstate,
+                                   sizeof(xstate)) < 0)
+            return -1;
           return pid;
         }
         release(&np->lock);
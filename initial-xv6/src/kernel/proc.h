@@ -21,6 +21,9 @@ struct context
   uint64 s11;
 };
 
+// Every hart's bit in proc.tlbstale.
+#define TLB_ALLHARTS ((1UL << NCPU) - 1)
+
 // Per-CPU state.
 struct cpu
 {
@@ -28,6 +31,8 @@ struct cpu
   struct context context; // swtch() here to enter scheduler().
   int noff;               // Depth of push_off() nesting.
   int intena;             // Were interrupts enabled before push_off()?
+  int idle;               // In wfi, waiting for work; see idle() in proc.c
+  uint64 timer;           // When its timer is armed for, or 0; see timerarm()
 };
 
 extern struct cpu cpus[NCPU];
@@ -94,6 +99,42 @@ enum procstate
   ZOMBIE
 };
 
+// An ELF segment that exec() left to be paged in on demand.
+struct execseg
+{
+  struct inode *ip; // binary to read pages from, or 0 if unused
+  uint64 va;        // page-aligned start address
+  uint64 memsz;     // bytes of memory
+  uint64 filesz;    // bytes of memory backed by the file
+  uint off;         // file offset of va
+  int perm;         // PTE permission bits for its pages
+};
+
+// A region mapped by mmap().
+struct vma
+{
+  uint64 addr;     // page-aligned start, or 0 if unused
+  uint64 len;      // bytes, a multiple of PGSIZE
+  int prot;        // PROT_READ, PROT_WRITE
+  int flags;       // MAP_SHARED or MAP_PRIVATE
+  struct file *f;  // mapped file, or 0 if anonymous
+  struct shm *shm; // anonymous shared memory, or 0
+  uint off;        // file (or shm) offset of addr
+};
+
+#ifdef SCHED_MLFQ
+#define NQUEUE    4   // MLFQ priority levels, 0 the highest
+#define MLFQBOOST 48  // ticks between priority boosts
+#else
+#define NQUEUE    1
+#endif
+
+#if defined(SCHED_STRIDE) || defined(SCHED_LOTTERY)
+#define SCHED_SHARE   // proportional share
+#endif
+#define DEFTICKETS 10         // tickets of a new process
+#define STRIDE1    (1 << 20)  // stride of a process with 1 ticket
+
 // Per-process state
 struct proc
 {
@@ -105,6 +146,25 @@ struct proc
   int killed;           // If non-zero, have been killed
   int xstate;           // Exit status to be returned to parent's wait
   int pid;              // Process ID
+  int cpu;              // CPU it last ran on; its run queue
+
+  // p->lock, or the run queue's lock while p is on one:
+  int level;            // MLFQ priority level
+  int slice;            // ticks used at this level
+  int tickets;          // share of the CPU, for stride and lottery
+  int stride;           // STRIDE1 / tickets
+  uint64 pass;          // stride virtual time
+
+  // the run queue's lock must be held when using this:
+  struct proc *rqnext;  // next process on the run queue
+
+  // the wait channel list's lock must be held when using these:
+  struct proc *wnext;   // processes sleeping on chans that hash alike
+  struct proc *wprev;
+
+  // tickslock must be held when using these:
+  uint wakeat;          // tick to wake from sleep() at
+  int tqidx;            // index in the timeout heap, or -1
 
   // wait_lock must be held when using this:
   struct proc *parent; // Parent process
@@ -121,6 +181,11 @@ struct proc
   uint rtime;                  // How long the process ran for
   uint ctime;                  // When was the process created
   uint etime;                  // When did the process exited
+  struct execseg seg[NEXECSEG]; // not-yet-loaded program segments
+  struct vma vma[NVMA];        // mmap regions
+  int hugeheap;                // back the heap with 2MB pages
+  int asid;                    // address-space ID, or 0 if none
+  uint64 tlbstale;             // harts that must flush asid
 };
 
 extern struct proc proc[NPROC];
@@ -0,0 +1,121 @@
+// Anonymous shared memory, for mmap(MAP_SHARED|MAP_ANONYMOUS).
+//
+// The pages of such a region must stay shared with fork()ed
+// children even if nobody touches them until after the fork,
+// so they belong to a shm object rather than to a page table.
+// Each process maps the object's page when it faults on it
+// (see vmafault()), allocating it zeroed on first use. The
+// object holds one reference to each of its pages, and goes
+// away when the last region using it is unmapped.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "defs.h"
+
+struct shm {
+  int ref;          // regions using it; 0 if free
+  int npages;
+  uint64 *pages;    // a kalloc()ed page of physical addresses,
+                    // 0 for pages not yet touched
+};
+
+struct {
+  struct spinlock lock;
+  struct shm shm[NSHM];
+} shmtab;
+
+void
+shminit(void)
+{
+  initlock(&shmtab.lock, "shm");
+}
+
+// Allocate an object of npages zero pages, with one reference.
+// Returns 0 if npages is too many or there is no free object.
+struct shm *
+shmalloc(int npages)
+{
+  struct shm *s;
+  uint64 *pages;
+
+  if(npages <= 0 || npages > SHMMAXPAGES)
+    return 0;
+  if((pages = (uint64*)kalloc_zeroed()) == 0)
+    return 0;
+
+  acquire(&shmtab.lock);
+  for(s = shmtab.shm; s < &shmtab.shm[NSHM]; s++){
+    if(s->ref == 0){
+      s->ref = 1;
+      s->npages = npages;
+      s->pages = pages;
+      release(&shmtab.lock);
+      return s;
+    }
+  }
+  release(&shmtab.lock);
+  kfree(pages);
+  return 0;
+}
+
+// Take another reference to s, for a new region using it.
+void
+shmdup(struct shm *s)
+{
+  acquire(&shmtab.lock);
+  s->ref++;
+  release(&shmtab.lock);
+}
+
+// Drop a reference to s, freeing it and its pages with the last.
+// Pages still mapped somewhere stay until they are unmapped.
+void
+shmput(struct shm *s)
+{
+  uint64 *pages;
+  int n;
+
+  acquire(&shmtab.lock);
+  if(--s->ref > 0){
+    release(&shmtab.lock);
+    return;
+  }
+  pages = s->pages;
+  n = s->npages;
+  s->pages = 0;
+  release(&shmtab.lock);
+
+  for(int i = 0; i < n; i++){
+    if(pages[i])
+      kfree((void*)pages[i]);
+  }
+  kfree(pages);
+}
+
+// Return page i of s with a reference taken for the caller,
+// allocating it if this is its first use. Returns 0 if i is out
+// of range or memory is exhausted.
+uint64
+shmpage(struct shm *s, int i)
+{
+  char *mem;
+  uint64 pa;
+
+  if(i < 0 || i >= s->npages)
+    return 0;
+
+  acquire(&shmtab.lock);
+  if(s->pages[i] == 0){
+    if((mem = kalloc_zeroed()) == 0){
+      release(&shmtab.lock);
+      return 0;
+    }
+    s->pages[i] = (uint64)mem;
+  }
+  pa = s->pages[i];
+  incref(pa);
+  release(&shmtab.lock);
+  return pa;
+}
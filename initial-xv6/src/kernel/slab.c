@@ -0,0 +1,213 @@
+// Slab allocator for kernel objects smaller than a page.
+//
+// Each cache hands out objects of one size. It carves pages from
+// kalloc() into slabs: a struct slab header at the start of the
+// page, then as many objects as fit, the free ones on a list
+// threaded through their first word. Slabs with free objects are
+// on the cache's partial list; a full slab is on no list, and a
+// slab whose last object comes back is returned to kalloc().
+//
+// In front of the slabs each CPU keeps a magazine, a small stack
+// of free objects, so that most allocations and frees touch only
+// the local magazine with interrupts off and take no lock. An
+// empty magazine is refilled, and a full one half drained, in a
+// batch under the cache's lock.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "defs.h"
+
+#define NCACHE  8   // caches in the system
+#define MAGSIZE 16  // objects per CPU magazine
+
+struct slab {
+  struct kmem_cache *cache;
+  struct slab *next;      // partial list
+  struct slab *prev;
+  void *free;             // free objects in this slab
+  int inuse;              // objects allocated, magazines included
+};
+
+struct magazine {
+  int n;
+  void *obj[MAGSIZE];
+} __attribute__((aligned(64)));
+
+struct kmem_cache {
+  struct spinlock lock;   // protects the slabs
+  char *name;
+  uint size;              // object size, rounded up
+  int perslab;            // objects per slab
+  struct slab *partial;   // slabs with free objects
+  struct magazine mag[NCPU];
+};
+
+struct {
+  struct spinlock lock;
+  struct kmem_cache cache[NCACHE];
+  int n;
+} slabtab;
+
+#define SLABHDR ((sizeof(struct slab) + 7) & ~7)
+
+void
+slabinit(void)
+{
+  initlock(&slabtab.lock, "slabtab");
+}
+
+// Make a cache of objects of size bytes. Panics if the size
+// does not fit in a slab or there are too many caches, since
+// caches are only made at boot.
+struct kmem_cache *
+kmem_cache_create(char *name, uint size)
+{
+  struct kmem_cache *c;
+
+  size = (size + 7) & ~7;
+  if(size < sizeof(void*))
+    size = sizeof(void*);
+  if(size > PGSIZE - SLABHDR)
+    panic("kmem_cache_create: size");
+
+  acquire(&slabtab.lock);
+  if(slabtab.n == NCACHE)
+    panic("kmem_cache_create: too many caches");
+  c = &slabtab.cache[slabtab.n++];
+  release(&slabtab.lock);
+
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size;
+  c->perslab = (PGSIZE - SLABHDR) / size;
+  return c;
+}
+
+// Take a page from kalloc() for a new slab of c, and put it on
+// the partial list. Returns 0 if memory is exhausted.
+// Caller must hold c->lock.
+static struct slab *
+newslab(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *obj;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->inuse = 0;
+  s->free = 0;
+  for(int i = c->perslab - 1; i >= 0; i--){
+    obj = (char*)s + SLABHDR + i * c->size;
+    *(void**)obj = s->free;
+    s->free = obj;
+  }
+  s->prev = 0;
+  s->next = c->partial;
+  if(c->partial)
+    c->partial->prev = s;
+  c->partial = s;
+  return s;
+}
+
+// Take s off c's partial list.
+static void
+slabunlink(struct kmem_cache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// Take a free object from slab s of c.
+// Caller must hold c->lock.
+static void *
+slabget(struct kmem_cache *c, struct slab *s)
+{
+  void *obj = s->free;
+
+  s->free = *(void**)obj;
+  s->inuse++;
+  if(s->free == 0)
+    slabunlink(c, s);
+  return obj;
+}
+
+// Return obj to its slab, and the slab to kalloc() if that
+// was its last object in use.
+// Caller must hold c->lock.
+static void
+slabput(struct kmem_cache *c, void *obj)
+{
+  struct slab *s = (struct slab*)PGROUNDDOWN((uint64)obj);
+
+  if(s->cache != c || s->inuse <= 0)
+    panic("kmem_cache_free");
+  if(s->free == 0){
+    s->prev = 0;
+    s->next = c->partial;
+    if(c->partial)
+      c->partial->prev = s;
+    c->partial = s;
+  }
+  *(void**)obj = s->free;
+  s->free = obj;
+  if(--s->inuse == 0){
+    slabunlink(c, s);
+    kfree(s);
+  }
+}
+
+// Allocate an object from c. Its contents are undefined.
+// Returns 0 if memory is exhausted.
+void *
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct magazine *m;
+  struct slab *s;
+  void *obj = 0;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == 0){
+    acquire(&c->lock);
+    while(m->n < MAGSIZE / 2){
+      if((s = c->partial) == 0 && (s = newslab(c)) == 0)
+        break;
+      m->obj[m->n++] = slabget(c, s);
+    }
+    release(&c->lock);
+  }
+  if(m->n > 0)
+    obj = m->obj[--m->n];
+  pop_off();
+  return obj;
+}
+
+// Free obj, which kmem_cache_alloc(c) returned.
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  struct magazine *m;
+
+#ifdef KDEBUG
+  // Fill with junk to catch dangling refs.
+  memset(obj, 1, c->size);
+#endif
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == MAGSIZE){
+    acquire(&c->lock);
+    while(m->n > MAGSIZE / 2)
+      slabput(c, m->obj[--m->n]);
+    release(&c->lock);
+  }
+  m->obj[m->n++] = obj;
+  pop_off();
+}
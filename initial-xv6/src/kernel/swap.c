@@ -0,0 +1,299 @@
+// Swapping user pages out to disk.
+//
+// The swap area is the NSWAPBLOCK blocks of the disk past the
+// file system, divided into page-sized slots. When ualloc() finds
+// memory exhausted it calls swapout(), which runs a clock hand
+// over the user page tables of the current process and of
+// sleeping processes, clearing PTE_A as it passes a page and
+// evicting the first page it finds with PTE_A still clear.
+//
+// An evicted page's PTE becomes a swap entry: PTE_V clear,
+// PTE_SWAP set, the slot number where the physical page number
+// was, and the page's other flag bits kept, so that swapin() can
+// restore the mapping as it was. Swap entries are owned like
+// pages: fork() and page-table copies take another reference to
+// the slot (swapdup()), and unmapping drops one (swapfree()).
+//
+// Only pages that one PTE in an unshared page table maps are
+// evicted, so page-cache, shared-memory, zero and MAP_SHARED
+// pages stay put. Running processes other than the caller are
+// skipped: their TLBs may hold the page, and they may be in the
+// middle of copying to it. A sleeping process holds no physical
+// page address across its sleep, and flushes its TLB when it
+// next runs (see tlbstale).
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "buf.h"
+#include "fcntl.h"
+#include "defs.h"
+
+#define SWAPSTART FSSIZE                  // first block of swap
+#define BPS (PGSIZE / BSIZE)              // blocks per slot
+#define NSWAPSLOT (NSWAPBLOCK / BPS)
+#define SWAPBATCH 8                       // pages ualloc() frees at once
+
+#define PTE2SLOT(pte) ((pte) >> 10)
+#define SLOT2PTE(slot) ((uint64)(slot) << 10)
+
+struct {
+  struct spinlock lock;
+  uchar ref[NSWAPSLOT];   // swap entries naming each slot
+  uchar busy[NSWAPSLOT];  // being written out
+  int next;               // where to start looking for a free slot
+  int nout;               // pages swapped out, for swapstat()
+  int nin;                // pages swapped in
+} swap;
+
+// The clock hand: the process and address to scan next.
+struct {
+  struct spinlock lock;
+  int proc;
+  uint64 va;
+} hand;
+
+// One block buffer for swap I/O, outside the buffer cache.
+struct {
+  struct sleeplock lock;
+  struct buf b;
+} swapio;
+
+void
+swapinit(void)
+{
+  initlock(&swap.lock, "swap");
+  initlock(&hand.lock, "swaphand");
+  initsleeplock(&swapio.lock, "swapio");
+}
+
+// Allocate a slot with one reference, marked busy.
+// Returns -1 if swap is full.
+static int
+slotalloc(void)
+{
+  acquire(&swap.lock);
+  for(int i = 0; i < NSWAPSLOT; i++){
+    int s = (swap.next + i) % NSWAPSLOT;
+    if(swap.ref[s] == 0 && !swap.busy[s]){
+      swap.ref[s] = 1;
+      swap.busy[s] = 1;
+      swap.next = (s + 1) % NSWAPSLOT;
+      release(&swap.lock);
+      return s;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+// Take another reference to the slot of swap entry pte.
+void
+swapdup(pte_t pte)
+{
+  acquire(&swap.lock);
+  if(swap.ref[PTE2SLOT(pte)]++ == 255)
+    panic("swapdup");
+  release(&swap.lock);
+}
+
+// Drop a reference to the slot of swap entry pte.
+void
+swapfree(pte_t pte)
+{
+  acquire(&swap.lock);
+  if(swap.ref[PTE2SLOT(pte)]-- == 0)
+    panic("swapfree");
+  release(&swap.lock);
+}
+
+// Copy page pa to or from slot.
+static void
+slotrw(uint64 pa, int slot, int write)
+{
+  acquiresleep(&swapio.lock);
+  for(int i = 0; i < BPS; i++){
+    swapio.b.dev = ROOTDEV;
+    swapio.b.blockno = SWAPSTART + slot * BPS + i;
+    if(write)
+      memmove(swapio.b.data, (char*)pa + i * BSIZE, BSIZE);
+    virtio_disk_rw(&swapio.b, write);
+    if(!write)
+      memmove((char*)pa + i * BSIZE, swapio.b.data, BSIZE);
+  }
+  releasesleep(&swapio.lock);
+}
+
+// Can the page that pte maps in p at va be evicted?
+static int
+evictable(struct proc *p, uint64 va, pte_t pte)
+{
+  struct vma *v;
+
+  if((pte & (PTE_V | PTE_U)) != (PTE_V | PTE_U))
+    return 0;
+  if(getref(PTE2PA(pte)) != 1)
+    return 0;
+  // write-back needs the page itself.
+  v = findvma(p, va);
+  if(v && v->f && (v->flags & MAP_SHARED))
+    return 0;
+  return 1;
+}
+
+// Scan p's user pages from va up, clearing PTE_A bits, for an
+// evictable page that was not accessed since the hand last
+// passed it. Returns its PTE and sets *va, or returns 0 if the
+// scan reached the top of p's address space.
+// Caller must hold p->lock.
+static pte_t *
+scan(struct proc *p, uint64 *va)
+{
+  pagetable_t pt;
+  pte_t *pte;
+  uint64 a = *va, end;
+
+  while(a < TRAPFRAME){
+    pte_t pde2 = p->pagetable[PX(2, a)];
+    if((pde2 & PTE_V) == 0){
+      a = (a + (1L << PXSHIFT(2))) & ~((1L << PXSHIFT(2)) - 1);
+      continue;
+    }
+    pte_t pde1 = ((pagetable_t)PTE2PA(pde2))[PX(1, a)];
+    pt = (pagetable_t)PTE2PA(pde1);
+    // skip megapages and page tables shared with another process.
+    if((pde1 & PTE_V) == 0 || (pde1 & PTE_MEGA) || getref((uint64)pt) != 1){
+      a = MEGAROUNDDOWN(a) + MEGAPGSIZE;
+      continue;
+    }
+    for(end = MEGAROUNDDOWN(a) + MEGAPGSIZE; a < end; a += PGSIZE){
+      pte = &pt[PX(0, a)];
+      if(!evictable(p, a, *pte))
+        continue;
+      if(*pte & PTE_A){
+        *pte &= ~PTE_A;
+        continue;
+      }
+      *va = a;
+      return pte;
+    }
+  }
+  return 0;
+}
+
+// Evict one user page to swap and free it.
+// Returns 0 if a page was freed, -1 if nothing could be.
+int
+swapout(void)
+{
+  struct proc *p, *me = myproc();
+  pte_t *pte = 0;
+  uint64 pa, va;
+  int slot = -1;
+
+  acquire(&hand.lock);
+  // twice round, so that pages whose PTE_A the first
+  // lap cleared can go on the second.
+  for(int n = 0; n < 2 * NPROC + 1 && pte == 0; n++){
+    p = &proc[hand.proc];
+    acquire(&p->lock);
+    if((p == me || p->state == SLEEPING) && p->pagetable &&
+       (pte = scan(p, &hand.va)) != 0){
+      va = hand.va;
+      pa = PTE2PA(*pte);
+      if((slot = slotalloc()) < 0){
+        release(&p->lock);
+        release(&hand.lock);
+        return -1;
+      }
+      *pte = SLOT2PTE(slot) | (PTE_FLAGS(*pte) & ~PTE_V) | PTE_SWAP;
+      if(p == me)
+        tlbflush(p->pagetable, va);
+      hand.va = va + PGSIZE;
+    } else {
+      hand.proc = (hand.proc + 1) % NPROC;
+      hand.va = 0;
+    }
+    // the TLB may hold PTEs from before the scan changed
+    // them: flush before the process next runs.
+    if(p != me)
+      p->tlbstale = TLB_ALLHARTS;
+    release(&p->lock);
+  }
+  release(&hand.lock);
+  if(pte == 0)
+    return -1;
+
+  // the page is ours now; swapin() waits until it is written.
+  slotrw(pa, slot, 1);
+  acquire(&swap.lock);
+  swap.busy[slot] = 0;
+  swap.nout++;
+  release(&swap.lock);
+  wakeup(&swap.busy[slot]);
+  kfree((void*)pa);
+  return 0;
+}
+
+// Read the page of p at va back in from swap.
+// Returns 0 on success, -1 on failure.
+int
+swapin(struct proc *p, uint64 va)
+{
+  pte_t *pte;
+  char *mem;
+  int slot;
+
+  // the page table may be shared; its copy holds its own
+  // reference to the slot.
+  if((pte = walkmod(p->pagetable, va, 0)) == 0 || (*pte & PTE_SWAP) == 0)
+    return -1;
+  slot = PTE2SLOT(*pte);
+  if((mem = ualloc()) == 0)
+    return -1;
+
+  acquire(&swap.lock);
+  while(swap.busy[slot])
+    sleep(&swap.busy[slot], &swap.lock);
+  swap.nin++;
+  release(&swap.lock);
+  slotrw((uint64)mem, slot, 0);
+
+  // only this process changes its swap entries.
+  swapfree(*pte);
+  *pte = PA2PTE(mem) | (PTE_FLAGS(*pte) & ~PTE_SWAP) | PTE_V;
+  return 0;
+}
+
+// Allocate a page for user memory, swapping other user pages
+// out if memory is exhausted. Frees a few at a time, so that
+// the page-table pages that mapping it may need, which come
+// straight from kalloc(), are there too. May sleep.
+void *
+ualloc(void)
+{
+  void *mem;
+
+  while((mem = kalloc()) == 0){
+    if(swapout() < 0)
+      return 0;
+    for(int i = 1; i < SWAPBATCH; i++)
+      swapout();
+  }
+  return mem;
+}
+
+// Report pages swapped out and in so far.
+void
+swapstat(int *out, int *in)
+{
+  acquire(&swap.lock);
+  *out = swap.nout;
+  *in = swap.nin;
+  release(&swap.lock);
+}
@@ -12,7 +12,8 @@ int
 fetchaddr(uint64 addr, uint64 *ip)
 {
   struct proc *p = myproc();
-  if(addr >= p->sz || addr+sizeof(uint64) > p->sz) // both tests needed, in case of overflow
+  // both tests needed, in case of overflow; copyin() checks mmap regions.
+  if((addr >= p->sz || addr+sizeof(uint64) > p->sz) && findvma(p, addr) == 0)
     return -1;
   if(copyin(p->pagetable, (char *)ip, addr, sizeof(*ip)) != 0)
     return -1;
@@ -102,6 +103,14 @@ extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
 extern uint64 sys_waitx(void);
+extern uint64 sys_freepages(void);
+extern uint64 sys_spawn(void);
+extern uint64 sys_hugeheap(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_swapstat(void);
+extern uint64 sys_buddystat(void);
+extern uint64 sys_settickets(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -128,6 +137,14 @@ static uint64 (*syscalls[])(void) = {
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
 [SYS_waitx]   sys_waitx,
+[SYS_freepages] sys_freepages,
+[SYS_spawn]   sys_spawn,
+[SYS_hugeheap] sys_hugeheap,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_swapstat] sys_swapstat,
+[SYS_buddystat] sys_buddystat,
+[SYS_settickets] sys_settickets,
 };
 
 void
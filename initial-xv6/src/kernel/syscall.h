@@ -21,3 +21,11 @@
 #define SYS_mkdir  20
 #define SYS_close  21
 #define SYS_waitx  22
+#define SYS_freepages 23
+#define SYS_spawn  24
+#define SYS_hugeheap 25
+#define SYS_mmap   26
+#define SYS_munmap 27
+#define SYS_swapstat 28
+#define SYS_buddystat 29
+#define SYS_settickets 30
@@ -52,22 +52,9 @@ uint64
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
   argint(0, &n);
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while (ticks - ticks0 < n)
-  {
-    if (killed(myproc()))
-    {
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  return ticksleep(n);
 }
 
 uint64
@@ -107,4 +94,63 @@ sys_waitx(void)
   if (copyout(p->pagetable, addr2, (char *)&rtime, sizeof(int)) < 0)
     return -1;
   return ret;
-}
\ No newline at end of file
+}
+
+// return the number of free physical pages.
+uint64
+sys_freepages(void)
+{
+  return kfreepages();
+}
+
+// back heap pages touched from now on with 2MB pages,
+// where a whole aligned 2MB of heap is untouched.
+uint64
+sys_hugeheap(void)
+{
+  int on;
+
+  argint(0, &on);
+  myproc()->hugeheap = (on != 0);
+  return 0;
+}
+
+// copy out the number of pages swapped out and in so far.
+uint64
+sys_swapstat(void)
+{
+  uint64 addr;
+  int st[2];
+
+  argaddr(0, &addr);
+  swapstat(&st[0], &st[1]);
+  if(copyout(myproc()->pagetable, addr, (char*)st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+// copy out the number of free blocks of each size: MAXORDER+1
+// counts, of blocks of 1, 2, 4, ... pages.
+uint64
+sys_buddystat(void)
+{
+  uint64 addr;
+  int nfree[MAXORDER+1];
+
+  argaddr(0, &addr);
+  kbuddystat(nfree);
+  if(copyout(myproc()->pagetable, addr, (char*)nfree, sizeof(nfree)) < 0)
+    return -1;
+  return 0;
+}
+
+// set the calling process's tickets, its share of the CPU
+// under the stride and lottery schedulers.
+uint64
+sys_settickets(void)
+{
+  int n;
+
+  argint(0, &n);
+  return settickets(n);
+}
@@ -9,6 +9,14 @@
 struct spinlock tickslock;
 uint ticks;
 
+// Processes in ticksleep(), in a min-heap on p->wakeat, so
+// that the clock wakes each one only when its time comes.
+// tickslock protects it.
+#define NOWAKE 0xffffffff
+struct proc *tq[NPROC];
+int ntq;
+uint nextwake = NOWAKE; // tq[0]->wakeat, for timerarm()
+
 extern char trampoline[], uservec[], userret[];
 
 // in kernelvec.S, calls kerneltrap().
@@ -69,6 +77,18 @@ void usertrap(void)
 
     syscall();
   }
+  else if ((scause == 12 || scause == 13 || scause == 15) &&
+           walkaddr(p->pagetable, r_stval()) == 0)
+  {
+    // Instruction, load or store page fault on an unmapped page:
+    // a program page not yet paged in, or an untouched heap page.
+    uint64 va = r_stval(); // Faulting virtual address
+    if (handle_lazy_fault(va, scause == 15) != 0)
+    {
+      printf("usertrap(): lazy allocation failed at va %p pid=%d\n", va, p->pid);
+      setkilled(p);
+    }
+  }
   else if (scause == 15)
   {
     // Store/AMO page fault
@@ -98,8 +118,9 @@ void usertrap(void)
   if (killed(p))
     exit(-1);
 
-  // Give up the CPU if this is a timer interrupt.
-  if (which_dev == 2)
+  // Give up the CPU if this is a timer interrupt
+  // and the scheduling policy says so.
+  if (which_dev == 2 && timeslice(p))
     yield();
 
   usertrapret();
@@ -140,8 +161,16 @@ void usertrapret(void)
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
 
+  // the process's page table may have changed since it last ran
+  // on this hart; then flush its ASID's stale entries.
+  uint64 hart = 1UL << cpuid();
+  if(p->asid && (__atomic_load_n(&p->tlbstale, __ATOMIC_ACQUIRE) & hart)){
+    __atomic_and_fetch(&p->tlbstale, ~hart, __ATOMIC_ACQ_REL);
+    sfence_vma_asid(p->asid);
+  }
+
   // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  uint64 satp = MAKE_SATP_ASID(p->pagetable, p->asid);
 
   // jump to userret in trampoline.S at the top of memory, which
   // switches to the user page table, restores user registers,
@@ -181,27 +210,187 @@ void kerneltrap()
   w_sstatus(sstatus);
 }
 
+static void
+tqset(int i, struct proc *p)
+{
+  tq[i] = p;
+  p->tqidx = i;
+}
+
+// Move the process at i up or down the heap to its place.
+static void
+tqfix(int i)
+{
+  struct proc *p = tq[i];
+  int c;
+
+  while (i > 0 && tq[(i - 1) / 2]->wakeat > p->wakeat)
+  {
+    tqset(i, tq[(i - 1) / 2]);
+    i = (i - 1) / 2;
+  }
+  for (;;)
+  {
+    c = 2 * i + 1;
+    if (c >= ntq)
+      break;
+    if (c + 1 < ntq && tq[c + 1]->wakeat < tq[c]->wakeat)
+      c++;
+    if (tq[c]->wakeat >= p->wakeat)
+      break;
+    tqset(i, tq[c]);
+    i = c;
+  }
+  tqset(i, p);
+  nextwake = tq[0]->wakeat;
+}
+
+// Put p on the heap to be woken at tick t.
+static void
+tqput(struct proc *p, uint t)
+{
+  p->wakeat = t;
+  tq[ntq++] = p;
+  tqfix(ntq - 1);
+  if (p->tqidx == 0)
+  {
+    // CPU 0 keeps the deadline while idle; have it re-arm.
+    __sync_synchronize();
+    if (cpus[0].idle)
+      ipi(0);
+  }
+}
+
+// Take p off the heap.
+static void
+tqdel(struct proc *p)
+{
+  int i = p->tqidx;
+
+  p->tqidx = -1;
+  if (--ntq == i)
+  {
+    if (ntq == 0)
+      nextwake = NOWAKE;
+    return;
+  }
+  tq[i] = tq[ntq];
+  tqfix(i);
+}
+
+// Bring ticks up to date with the time, and wake sleepers
+// whose deadline has come. Called on each tick of a busy CPU,
+// and by a CPU leaving idle, since no CPU takes ticks while
+// all are idle; so ticks may advance by several at once.
 void clockintr()
 {
+  uint now = r_time() / TICKCYCLES;
+  uint then;
+
+  // Another CPU may have taken this tick already.
+  if (now == __atomic_load_n(&ticks, __ATOMIC_RELAXED))
+    return;
   acquire(&tickslock);
-  ticks++;
+  then = ticks;
+  if (now == then)
+  {
+    release(&tickslock);
+    return;
+  }
+  ticks = now;
   update_time();
-  // for (struct proc *p = proc; p < &proc[NPROC]; p++)
-  // {
-  //   acquire(&p->lock);
-  //   if (p->state == RUNNING)
-  //   {
-  //     printf("here");
-  //     p->rtime++;
-  //   }
-  //   // if (p->state == SLEEPING)
-  //   // {
-  //   //   p->wtime++;
-  //   // }
-  //   release(&p->lock);
-  // }
-  wakeup(&ticks);
+  while (ntq > 0 && tq[0]->wakeat <= ticks)
+  {
+    struct proc *p = tq[0];
+    tqdel(p);
+    wakeup(&p->wakeat);
+  }
   release(&tickslock);
+#ifdef SCHED_MLFQ
+  if (now / MLFQBOOST != then / MLFQBOOST)
+    mlfqboost();
+#endif
+}
+
+// Sleep for n ticks. Returns -1 if killed before then.
+int ticksleep(uint n)
+{
+  struct proc *p = myproc();
+  uint ticks0;
+  int r = 0;
+
+  acquire(&tickslock);
+  ticks0 = ticks;
+  if (n > 0)
+    tqput(p, ticks0 + n);
+  while (ticks - ticks0 < n)
+  {
+    if (killed(p))
+    {
+      r = -1;
+      break;
+    }
+    sleep(&p->wakeat, &tickslock);
+  }
+  if (p->tqidx >= 0)
+    tqdel(p);
+  release(&tickslock);
+  return r;
+}
+
+// Arm this CPU's one-shot timer for its next deadline. A CPU
+// running a process takes every tick, for time slices and
+// accounting. An idle CPU takes none, except that CPU 0 wakes
+// for the earliest sleep() deadline, since some CPU must.
+// Interrupts must be off.
+void timerarm(void)
+{
+  struct cpu *c = mycpu();
+  uint64 when = 0;
+
+  if (c->proc)
+    when = (r_time() / TICKCYCLES + 1) * TICKCYCLES;
+  else if (c == &cpus[0] && nextwake != NOWAKE)
+    when = (uint64)nextwake * TICKCYCLES;
+
+  if (when == 0)
+  {
+    if (c->timer)
+    {
+      *(uint64 *)CLINT_MTIMECMP(cpuid()) = -1;
+      c->timer = 0;
+    }
+  }
+  else if (c->timer == 0 || when < c->timer)
+  {
+    *(uint64 *)CLINT_MTIMECMP(cpuid()) = when;
+    c->timer = when;
+  }
+}
+
+// Interrupt CPU cpu, to wake it from wfi. timervec turns the
+// machine-mode software interrupt into a supervisor one.
+void ipi(int cpu)
+{
+  *(uint32 *)CLINT_MSIP(cpu) = 1;
+}
+
+// A supervisor software interrupt: this CPU's timer went off,
+// or another CPU sent an ipi(). Returns 2 if a tick was due,
+// 1 if not.
+static int
+timerintr(void)
+{
+  struct cpu *c = mycpu();
+  int due = c->timer != 0 && r_time() >= c->timer;
+
+  if (due)
+  {
+    c->timer = 0; // timervec disarmed it
+    clockintr();
+  }
+  timerarm();
+  return due ? 2 : 1;
 }
 
 // check if it's an external interrupt or software interrupt,
@@ -244,19 +433,15 @@ int devintr()
   }
   else if (scause == 0x8000000000000001L)
   {
-    // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
-
-    if (cpuid() == 0)
-    {
-      clockintr();
-    }
+    // software interrupt from a machine-mode timer or
+    // software interrupt, forwarded by timervec in kernelvec.S.
 
     // acknowledge the software interrupt by clearing
-    // the SSIP bit in sip.
+    // the SSIP bit in sip, before looking at why, so that
+    // another one that comes meanwhile is not lost.
     w_sip(r_sip() & ~2);
 
-    return 2;
+    return timerintr();
   }
   else
   {
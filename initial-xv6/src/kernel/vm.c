@@ -6,6 +6,7 @@
 #include "fs.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "page.h"
 #include "param.h"       // Include param.h to get definitions of NCPU, NOFILE, NPROC
 
 /*
@@ -17,10 +18,22 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+// largest ASID the hardware supports, 0 if it has none.
+int asidmax;
+
+// a single read-only page of zeroes, mapped copy-on-write by
+// read faults on untouched heap pages. the kernel holds a
+// reference of its own, so its count never drops to zero and
+// never looks private to handle_cow_fault().
+char *zeropage;
+
 // External functions
 extern void incref(uint64 pa);
 extern void decref(uint64 pa);
 
+static pte_t *walklevel(pagetable_t, uint64, int, int);
+static pte_t *cowbreak(struct proc*, uint64);
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
@@ -37,13 +50,18 @@ kvmmake(void)
   kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
 
   // PLIC
-  kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
+  kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W | PTE_MEGA);
+
+  // CLINT, for timerarm() and ipi() to set timers and send
+  // interrupts to other harts.
+  kvmmap(kpgtbl, CLINT, CLINT, 0x10000, PTE_R | PTE_W);
 
   // map kernel text executable and read-only.
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
-  // map kernel data and the physical RAM we'll make use of.
-  kvmmap(kpgtbl, (uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
+  // map kernel data and the physical RAM we'll make use of,
+  // with megapages from the first 2MB boundary on.
+  kvmmap(kpgtbl, (uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W | PTE_MEGA);
 
   // map the trampoline for trap entry/exit to
   // the highest virtual address in the kernel.
@@ -60,6 +78,10 @@ void
 kvminit(void)
 {
   kernel_pagetable = kvmmake();
+
+  if((zeropage = kalloc()) == 0)
+    panic("kvminit: zeropage");
+  memset(zeropage, 0, PGSIZE);
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -70,12 +92,42 @@ kvminithart()
   // wait for any previous writes to the page table memory to finish.
   sfence_vma();
 
+  // find out how many ASID bits the hardware has: it keeps
+  // only those of an all-ones ASID. the kernel runs in ASID 0.
+  w_satp(MAKE_SATP(kernel_pagetable) | SATP_ASID_MASK);
+  asidmax = (r_satp() & SATP_ASID_MASK) >> SATP_ASID_SHIFT;
   w_satp(MAKE_SATP(kernel_pagetable));
 
   // flush stale entries from the TLB.
   sfence_vma();
 }
 
+// Flush the TLB after changing or removing the PTE for va in
+// pagetable, or any of its PTEs if va is MAXVA. Only the current
+// process's page table is live, so others need nothing. With
+// ASIDs this flushes just the process's entries on this hart;
+// the other harts flush theirs before the process next runs
+// there (see usertrapret()).
+void
+tlbflush(pagetable_t pagetable, uint64 va)
+{
+  struct proc *p = myproc();
+
+  if(p == 0 || pagetable != p->pagetable)
+    return;
+  if(p->asid == 0){
+    sfence_vma();
+    return;
+  }
+  push_off();
+  if(va == MAXVA)
+    sfence_vma_asid(p->asid);
+  else
+    sfence_vma_page(PGROUNDDOWN(va), p->asid);
+  __atomic_or_fetch(&p->tlbstale, TLB_ALLHARTS & ~(1UL << cpuid()), __ATOMIC_ACQ_REL);
+  pop_off();
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
@@ -88,24 +140,105 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+//
+// If a 2MB megapage maps va, returns its level-1 PTE,
+// which has PTE_MEGA set.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+  return walklevel(pagetable, va, 0, alloc);
+}
+
+// Like walk(), but return the PTE at the given level:
+// 0 for a page, 1 for a megapage.
+static pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int target, int alloc)
 {
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
+  for(int level = 2; level > target; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
-    if(*pte & PTE_V) {
+    if(*pte & PTE_MEGA) {
+      return pte;
+    } else if(*pte & PTE_V) {
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
-  return &pagetable[PX(0, va)];
+  return &pagetable[PX(target, va)];
+}
+
+// Drop a reference to leaf page-table page pt, which fork()
+// may have shared between processes. The last reference also
+// drops pt's references to the pages it maps.
+static void
+ptput(pagetable_t pt)
+{
+  if(!kunref(pt))
+    return;
+  for(int i = 0; i < 512; i++){
+    if(pt[i] & PTE_V)
+      kfree((void*)PTE2PA(pt[i]));
+    else if(pt[i] & PTE_SWAP)
+      swapfree(pt[i]);
+    pt[i] = 0;
+  }
+  kfree(pt);
+}
+
+// Like walk(), for a caller that is about to change the PTE.
+// If the leaf page-table page holding it is shared with another
+// process, first give pagetable its own copy, which takes its
+// own references to the mapped pages.
+pte_t *
+walkmod(pagetable_t pagetable, uint64 va, int alloc)
+{
+  pte_t *pde;
+  pagetable_t pt, copy;
+
+  if(walk(pagetable, va, alloc) == 0)
+    return 0;
+  pde = &((pagetable_t)PTE2PA(pagetable[PX(2, va)]))[PX(1, va)];
+
+  if(*pde & PTE_MEGA){
+    // Split the megapage into 512 PTEs in a new leaf table.
+    uint64 pa = PTE2PA(*pde);
+    if((*pde & PTE_U) == 0)
+      panic("walkmod: kernel megapage");
+    if((pt = (pagetable_t)kalloc()) == 0)
+      return 0;
+    for(int i = 0; i < 512; i++)
+      pt[i] = PA2PTE(pa + i*PGSIZE) | (PTE_FLAGS(*pde) & ~PTE_MEGA);
+    khugesplit(pa);
+    *pde = PA2PTE(pt) | PTE_V;
+    tlbflush(pagetable, MAXVA);
+  }
+  pt = (pagetable_t)PTE2PA(*pde);
+
+  if(getref((uint64)pt) > 1){
+    if((copy = (pagetable_t)kalloc()) == 0)
+      return 0;
+    memmove(copy, pt, PGSIZE);
+    for(int i = 0; i < 512; i++){
+      if(copy[i] & PTE_V)
+        incref(PTE2PA(copy[i]));
+      else if(copy[i] & PTE_SWAP)
+        swapdup(copy[i]);
+    }
+    *pde = PA2PTE(copy) | PTE_V;
+    // the hardware may have cached the old pde.
+    tlbflush(pagetable, MAXVA);
+    ptput(pt);
+    pt = copy;
+  }
+
+  // the caller may make a PTE writable.
+  pa2page((uint64)pt)->flags &= ~PG_PTRO;
+  return &pt[PX(0, va)];
 }
 
 // Look up a virtual address, return the physical address,
@@ -128,6 +261,8 @@ walkaddr(pagetable_t pagetable, uint64 va)
   if((*pte & PTE_U) == 0)
     return 0;
   pa = PTE2PA(*pte);
+  if(*pte & PTE_MEGA)
+    pa += PGROUNDDOWN(va) & (MEGAPGSIZE-1);
   return pa;
 }
 
@@ -143,7 +278,9 @@ kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
-// be page-aligned. Returns 0 on success, -1 if walk() couldn't
+// be page-aligned. If perm includes PTE_MEGA, maps 2MB megapages
+// wherever va, pa and the size left allow, and pages elsewhere.
+// Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
@@ -157,11 +294,24 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
   for(;;){
-    if((pte = walk(pagetable, a, 1)) == 0)
+    if((perm & PTE_MEGA) && a % MEGAPGSIZE == 0 && pa % MEGAPGSIZE == 0 &&
+       last - a >= MEGAPGSIZE - PGSIZE){
+      if((pte = walklevel(pagetable, a, 1, 1)) == 0)
+        return -1;
+      if(*pte & PTE_V)
+        panic("mappages: remap");
+      *pte = PA2PTE(pa) | perm | PTE_V;
+      if(a + MEGAPGSIZE - PGSIZE == last)
+        break;
+      a += MEGAPGSIZE;
+      pa += MEGAPGSIZE;
+      continue;
+    }
+    if((pte = walkmod(pagetable, a, 1)) == 0)
       return -1;
     if(*pte & PTE_V)
       panic("mappages: remap");
-    *pte = PA2PTE(pa) | perm | PTE_V;
+    *pte = PA2PTE(pa) | (perm & ~PTE_MEGA) | PTE_V;
     if(a == last)
       break;
     a += PGSIZE;
@@ -171,22 +321,43 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 }
 
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages that were never mapped (untouched lazy
+// heap pages) are skipped.
 // Optionally free the physical memory.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
+  uint64 a, n = 0, last = 0;
   pte_t *pte;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
+    // lazily allocated heap pages may never have been touched.
     if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
+      continue;
+    if(*pte & PTE_SWAP){
+      if((pte = walkmod(pagetable, a, 0)) == 0)
+        panic("uvmunmap: unshare");
+      swapfree(*pte);
+      *pte = 0;
+      continue;
+    }
     if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+      continue;
+    if((*pte & PTE_MEGA) && a % MEGAPGSIZE == 0 &&
+       a + MEGAPGSIZE <= va + npages*PGSIZE){
+      // all of a megapage goes: no need to split it.
+      if(do_free)
+        khugeput(PTE2PA(*pte));
+      *pte = 0;
+      n += 512;
+      a += MEGAPGSIZE - PGSIZE;
+      continue;
+    }
+    if((pte = walkmod(pagetable, a, 0)) == 0)
+      panic("uvmunmap: unshare");
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
@@ -195,7 +366,15 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
       kfree((void*)pa);
     }
     *pte = 0;
+    last = a;
+    n++;
   }
+
+  // flush just the page if only one went.
+  if(n == 1)
+    tlbflush(pagetable, last);
+  else if(n > 1)
+    tlbflush(pagetable, MAXVA);
 }
 
 // create an empty user page table.
@@ -204,10 +383,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -221,8 +399,7 @@ uvmfirst(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("uvmfirst: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
@@ -240,12 +417,11 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_zeroed();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -295,11 +471,25 @@ freewalk(pagetable_t pagetable)
 
 // Free user memory pages,
 // then free page-table pages.
+// Leaf page-table pages may be shared with other processes,
+// so rather than unmapping page by page, drop each one with
+// ptput(), which frees the pages only with the last reference.
+// Everything still mapped must be user memory below sz.
 void
 uvmfree(pagetable_t pagetable, uint64 sz)
 {
-  if(sz > 0)
-    uvmunmap(pagetable, 0, PGROUNDUP(sz)/PGSIZE, 1);
+  for(int i = 0; i < 512; i++){
+    if((pagetable[i] & PTE_V) == 0)
+      continue;
+    pagetable_t pmd = (pagetable_t)PTE2PA(pagetable[i]);
+    for(int j = 0; j < 512; j++){
+      if(pmd[j] & PTE_MEGA)
+        khugeput(PTE2PA(pmd[j]));
+      else if(pmd[j] & PTE_V)
+        ptput((pagetable_t)PTE2PA(pmd[j]));
+      pmd[j] = 0;
+    }
+  }
   freewalk(pagetable);
 }
 
@@ -346,65 +536,130 @@ uvmclear(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
   
-  pte = walk(pagetable, va, 0);
+  pte = walkmod(pagetable, va, 0);
   if(pte == 0)
     panic("uvmclear");
   *pte &= ~PTE_U;
 }
 
-// Helper function to get the physical address of a writable page for `va`.
-uint64
-get_writable_pa(pagetable_t pagetable, uint64 va)
+// Where a copy to or from user memory last translated a page:
+// the leaf page table, so that the next page in the same 2MB is
+// an index into it rather than another walk from the root.
+struct ucursor {
+  pagetable_t pagetable;
+  pagetable_t leaf;   // 0 if none
+  uint64 base;        // the va that leaf[0] maps
+};
+
+// Return the PTE for user va, or the megapage PTE covering it,
+// or 0 if there is no leaf page table for it.
+static pte_t *
+upte(struct ucursor *c, uint64 va)
 {
-  if (va >= MAXVA)
-    return -1;
+  pte_t *pde;
 
-  va = PGROUNDDOWN(va);
-  pte_t *pte = walk(pagetable, va, 0);
-  if (pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0)
-    return -1;  // Invalid or inaccessible page.
-
-  // Handle COW if necessary.
-  if (*pte & PTE_COW) {
-    if (handle_cow_fault(va) < 0)  // Call the existing COW handler
-      return -1;  // COW fault handling failed.
-    
-    // Re-fetch the page table entry after handling.
-    pte = walk(pagetable, va, 0);
-    if (pte == 0 || (*pte & PTE_V) == 0)
-      return -1;  // Failed to obtain a valid PTE after COW handling.
+  if(c->leaf == 0 || MEGAROUNDDOWN(va) != c->base){
+    c->leaf = 0;
+    if((pde = walklevel(c->pagetable, va, 1, 0)) == 0 || (*pde & PTE_V) == 0)
+      return 0;
+    if(*pde & PTE_MEGA)
+      return pde;
+    c->leaf = (pagetable_t)PTE2PA(*pde);
+    c->base = MEGAROUNDDOWN(va);
+  }
+  return &c->leaf[PX(0, va)];
+}
+
+// Return the physical address of the user page at va, which is
+// page-aligned, for the kernel to copy from or, if write, to.
+// As the MMU and the page fault handler would for user code,
+// fault in the page if it is not there yet and, for a write,
+// break copy-on-write and mark the page dirty. Faults are only
+// handled in the current process's page table.
+// Returns 0 if the page is not accessible.
+static uint64
+upage(struct ucursor *c, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  int mine = p != 0 && c->pagetable == p->pagetable;
+  pte_t *pte;
+  uint64 pa;
+
+  if(va >= MAXVA)
+    return 0;
+
+  pte = upte(c, va);
+  if(pte == 0 || (*pte & (PTE_V | PTE_U)) != (PTE_V | PTE_U)){
+    // a fault may replace page-table pages.
+    c->leaf = 0;
+    if(!mine || handle_lazy_fault(va, write) != 0)
+      return 0;
+    pte = upte(c, va);
+    if(pte == 0 || (*pte & (PTE_V | PTE_U)) != (PTE_V | PTE_U))
+      return 0;
   }
 
-  return PTE2PA(*pte);  // Return the physical address of the writable page.
+  if(write){
+    if(*pte & PTE_COW){
+      c->leaf = 0;
+      if(!mine || (pte = cowbreak(p, va)) == 0)
+        return 0;
+    }
+    // text and read-only mmap pages may be shared with the
+    // page cache.
+    if((*pte & PTE_W) == 0)
+      return 0;
+    // the kernel's write bypasses the MMU: set PTE_D the way
+    // the hardware would, for mmap write-back.
+    *pte |= PTE_D;
+  }
+
+  pa = PTE2PA(*pte);
+  if(*pte & PTE_MEGA)
+    pa += va & (MEGAPGSIZE-1);
+  return pa;
+}
+
+// Fault in the user pages of [va, va+len) in the current process,
+// for writing if write is set, so that a copy to or from them can
+// then be made while holding an inode or buffer lock: paging in
+// from a file would need those locks itself. A page may still be
+// swapped out afterwards, but swapping it in takes no such lock.
+// Returns how many bytes from va on are accessible, up to len.
+uint64
+ufault(uint64 va, uint64 len, int write)
+{
+  struct ucursor c = { myproc()->pagetable, 0, 0 };
+  uint64 a;
+
+  for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE){
+    if(a < PGROUNDDOWN(va) || upage(&c, a, write) == 0)
+      return a > va ? a - va : 0;
+  }
+  return len;
 }
 
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
 int
-copyout(pagetable_t pagetable, uint64 va, char *src, uint64 len)
+copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
-  uint64 n, va0;
-  char *pa0;
-
-  while (len > 0) {
-    va0 = PGROUNDDOWN(va);
-
-    // Retrieve the writable physical address using `get_writable_pa`.
-    uint64 pa = get_writable_pa(pagetable, va0);
-    if (pa == -1) {
-      return -1;  // Failed to get a writable page.
-    }
+  struct ucursor c = { pagetable, 0, 0 };
+  uint64 n, va0, pa0;
 
-    pa0 = (char*)pa;
-    n = PGSIZE - (va - va0);
-    if (n > len)
+  while(len > 0){
+    va0 = PGROUNDDOWN(dstva);
+    if((pa0 = upage(&c, va0, 1)) == 0)
+      return -1;
+    n = PGSIZE - (dstva - va0);
+    if(n > len)
       n = len;
-    memmove(pa0 + (va - va0), src, n);
+    memmove((void *)(pa0 + (dstva - va0)), src, n);
 
     len -= n;
-    va = va0 + PGSIZE;
     src += n;
+    dstva = va0 + PGSIZE;
   }
   return 0;
 }
@@ -415,12 +670,12 @@ copyout(pagetable_t pagetable, uint64 va, char *src, uint64 len)
 int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
+  struct ucursor c = { pagetable, 0, 0 };
   uint64 n, va0, pa0;
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if((pa0 = upage(&c, va0, 0)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > len)
@@ -434,6 +689,9 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
   return 0;
 }
 
+// Does word w have a zero byte?
+#define HASZERO(w) (((w) - 0x0101010101010101UL) & ~(w) & 0x8080808080808080UL)
+
 // Copy a null-terminated string from user to kernel.
 // Copy bytes to dst from virtual address srcva in a given page table,
 // until a '\0', or max.
@@ -441,130 +699,348 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 int
 copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
-  uint64 n, va0, pa0;
-  int got_null = 0;
+  struct ucursor c = { pagetable, 0, 0 };
+  uint64 n, va0, pa0, w;
+  char *p;
 
-  while(got_null == 0 && max > 0){
+  while(max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if((pa0 = upage(&c, va0, 0)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > max)
       n = max;
-
-    char *p = (char *) (pa0 + (srcva - va0));
-    while(n > 0){
-      if(*p == '\0'){
-        *dst = '\0';
-        got_null = 1;
-        break;
-      } else {
-        *dst = *p;
+    max -= n;
+
+    p = (char *) (pa0 + (srcva - va0));
+    // a word at a time, up to the word with the '\0' in it,
+    // if dst and p can both be aligned.
+    if((((uint64)p ^ (uint64)dst) & 7) == 0){
+      for(; n > 0 && ((uint64)p & 7) != 0; n--){
+        if((*dst++ = *p++) == '\0')
+          return 0;
+      }
+      for(; n >= 8; n -= 8){
+        w = *(uint64*)p;
+        if(HASZERO(w))
+          break;
+        *(uint64*)dst = w;
+        p += 8;
+        dst += 8;
       }
-      --n;
-      --max;
-      p++;
-      dst++;
+    }
+    for(; n > 0; n--){
+      if((*dst++ = *p++) == '\0')
+        return 0;
     }
 
     srcva = va0 + PGSIZE;
   }
-  if(got_null){
-    return 0;
-  } else {
-    return -1;
-  }
+  return -1;
 }
 
-int
-uvmcopycow(pagetable_t old, pagetable_t new, uint64 sz)
+#define CC_SHARETABLES 1 // share whole leaf page-table pages
+#define CC_SHARED      2 // leave writable pages writable (MAP_SHARED)
+
+// Recursively share the user pages in [lo, hi) mapped by page-table
+// page old, which sits at the given level and maps virtual
+// addresses from base up, into page-table page new.
+// Walks each page-table page once and skips unmapped subtrees,
+// rather than walking from the root for every page. With
+// CC_SHARETABLES, leaf page-table pages are themselves shared, so
+// the cost does not grow with the number of pages mapped; that is
+// only safe where nothing outside [lo, hi) shares the tables.
+static int
+cowcopy(pagetable_t old, pagetable_t new, int level, uint64 base,
+        uint64 lo, uint64 hi, int flags)
 {
-  pte_t *pte;
-  uint64 pa, i;
-  uint flags;
-
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      // panic("uvmcopycow: pte should exist");
+  for(int i = 0; i < 512; i++){
+    uint64 va = base + ((uint64)i << PXSHIFT(level));
+    if(va >= hi)
+      break;
+    if(va + (1L << PXSHIFT(level)) <= lo)
       continue;
-    if((*pte & PTE_V) == 0)
+    pte_t pte = old[i];
+    if(level == 0 && (pte & PTE_SWAP)){
+      // both will read their own copy back in.
+      swapdup(pte);
+      new[i] = pte;
+      continue;
+    }
+    if((pte & PTE_V) == 0)
       continue;
-    pa = PTE2PA(*pte);
-    flags = PTE_FLAGS(*pte);
 
-    // Text pages should remain read-only but not marked as COW
-    if((flags & PTE_X) != 0) {
-      // This is a text page, just map it directly
-      if(mappages(new, i, PGSIZE, pa, flags) != 0)
-        goto err;
-      incref(pa);
+    if(level > 0){
+      if(pte & PTE_MEGA){
+        // a 2MB heap page: share it like any other page.
+        if(pte & PTE_W){
+          pte = (pte & ~PTE_W) | PTE_COW;
+          old[i] = pte;
+        }
+        khugeget(PTE2PA(pte));
+        new[i] = pte;
+        continue;
+      }
+      if(pte & (PTE_R|PTE_W|PTE_X))
+        panic("cowcopy: leaf");
+      if(level == 1 && (flags & CC_SHARETABLES) && (new[i] & PTE_V) == 0){
+        // Share the whole leaf page-table page rather than
+        // copying it; whoever first changes a PTE in it gets
+        // a private copy (see walkmod()). Its writable PTEs
+        // must become COW first, unless they already are.
+        pagetable_t pt = (pagetable_t)PTE2PA(pte);
+        struct page *pg = pa2page((uint64)pt);
+        if((pg->flags & PG_PTRO) == 0){
+          for(int j = 0; j < 512; j++){
+            if((pt[j] & PTE_V) && (pt[j] & PTE_X) == 0 && (pt[j] & PTE_W))
+              pt[j] = (pt[j] & ~PTE_W) | PTE_COW;
+          }
+          pg->flags |= PG_PTRO;
+        }
+        incref((uint64)pt);
+        new[i] = pte;
+        continue;
+      }
+      // trampoline and trapframe share the top-level
+      // table with the user image, so new may have it.
+      if((new[i] & PTE_V) == 0){
+        pagetable_t child = (pagetable_t)kalloc_zeroed();
+        if(child == 0)
+          return -1;
+        new[i] = PA2PTE(child) | PTE_V;
+      }
+      if(cowcopy((pagetable_t)PTE2PA(pte), (pagetable_t)PTE2PA(new[i]),
+                 level - 1, va, lo, hi, flags) < 0)
+        return -1;
       continue;
     }
-    
-    // Make page read-only and set COW flag
-    if(flags & PTE_W) {
-      flags = (flags & ~PTE_W) | PTE_COW;
-      *pte = PA2PTE(pa) | flags;
-    }
 
-    if(mappages(new, i, PGSIZE, pa, flags) != 0){
-      goto err;
+    if(new[i] & PTE_V)
+      panic("cowcopy: remap");
+    // Text pages stay read-only and are not marked COW;
+    // writable pages become read-only COW in both, unless
+    // they are meant to be shared.
+    if((flags & CC_SHARED) == 0 && (pte & PTE_X) == 0 && (pte & PTE_W)){
+      pte = (pte & ~PTE_W) | PTE_COW;
+      old[i] = pte;
     }
-    
-    // Increment reference count after successful mapping
-    incref(pa);
+    new[i] = pte;
+    incref(PTE2PA(pte));
   }
   return 0;
+}
 
-err:
-  uvmunmap(new, 0, i/PGSIZE, 1);
-  return -1;
+// Give new copy-on-write mappings of old's user pages below sz,
+// for fork(). On failure, whatever was mapped in new is left
+// for uvmfree() to release.
+int
+uvmcopycow(pagetable_t old, pagetable_t new, uint64 sz)
+{
+  if(cowcopy(old, new, 2, 0, 0, sz, CC_SHARETABLES) < 0)
+    return -1;
+  // the parent's writable pages just became read-only.
+  tlbflush(old, MAXVA);
+  return 0;
 }
 
+// Give new old's mappings of the len bytes of an mmap region at
+// va, for fork(). With shared set both keep writing to the same
+// pages; otherwise the pages become copy-on-write as for
+// uvmcopycow(). Regions lie next to each other, so their leaf
+// page-table pages are never shared.
 int
-handle_cow_fault(uint64 va)
+uvmcopyvma(pagetable_t old, pagetable_t new, uint64 va, uint64 len, int shared)
 {
-  struct proc *p = myproc();
-  if(p == 0)
+  if(cowcopy(old, new, 2, 0, va, va + len, shared ? CC_SHARED : 0) < 0)
     return -1;
+  if(!shared)
+    tlbflush(old, MAXVA);
+  return 0;
+}
 
+// Give p a private, writable copy of its copy-on-write page
+// at va, which is page-aligned. Returns the page's PTE, or 0 if
+// va is not a COW page or memory is exhausted.
+static pte_t *
+cowbreak(struct proc *p, uint64 va)
+{
   pte_t *pte;
   uint64 pa;
   uint flags;
   char *mem;
 
-  va = PGROUNDDOWN(va);
-  
-  if(va >= p->sz)
-    return -1;
+  // private mmap pages are copy-on-write too.
+  if(va >= p->sz && findvma(p, va) == 0)
+    return 0;
 
   if((pte = walk(p->pagetable, va, 0)) == 0)
-    return -1;
+    return 0;
 
   if((*pte & PTE_V) == 0 || (*pte & PTE_U) == 0)
-    return -1;
+    return 0;
 
   if(!(*pte & PTE_COW))
-    return -1;
+    return 0;
+
+  // take a private copy of the page table first, so that
+  // the reference count below counts this process's mapping.
+  if((pte = walkmod(p->pagetable, va, 0)) == 0)
+    return 0;
 
   pa = PTE2PA(*pte);
   flags = PTE_FLAGS(*pte);
 
-  // Allocate new page
-  if((mem = kalloc()) == 0)
-    return -1;
+  // If this is the last reference the page is already private:
+  // just make it writable again instead of copying it.
+  // Only this process maps the page, so nothing can raise the
+  // count behind our back.
+  if(pa != (uint64)zeropage && getref(pa) == 1){
+    *pte = PA2PTE(pa) | ((flags | PTE_W) & ~PTE_COW);
+    tlbflush(p->pagetable, va);
+    return pte;
+  }
+
+  // Allocate new page, swapping if need be. Hold on to the old
+  // one meanwhile, so that it cannot be what is swapped out.
+  incref(pa);
+  if((mem = ualloc()) == 0){
+    kfree((void*)pa);
+    return 0;
+  }
 
   // Copy old page contents
-  memmove(mem, (char*)pa, PGSIZE);
+  if(pa == (uint64)zeropage)
+    pagezero(mem);
+  else
+    memmove(mem, (char*)pa, PGSIZE);
 
   // Update PTE
   flags = (flags | PTE_W) & ~PTE_COW;
   *pte = PA2PTE((uint64)mem) | flags;
+  tlbflush(p->pagetable, va);
 
-  // Release old page
+  // Release our hold on the old page, and the mapping's.
   kfree((void*)pa);
-  
+  kfree((void*)pa);
+
+  return pte;
+}
+
+int
+handle_cow_fault(uint64 va)
+{
+  struct proc *p = myproc();
+
+  if(p == 0 || cowbreak(p, PGROUNDDOWN(va)) == 0)
+    return -1;
+  return 0;
+}
+
+// Map a zeroed 2MB page over the 2MB-aligned region around va,
+// for a process that asked for a huge heap with hugeheap().
+// Only if all of the region is below p->sz, outside the exec
+// segments, and nothing in it is mapped yet. Returns 0 on
+// success, -1 to fall back to a 4KB page.
+static int
+hugefault(struct proc *p, uint64 va)
+{
+  uint64 base = MEGAROUNDDOWN(va);
+  struct execseg *s;
+  pte_t *pde;
+  char *mem;
+
+  if(base + MEGAPGSIZE > p->sz)
+    return -1;
+  for(s = p->seg; s < &p->seg[NEXECSEG]; s++){
+    if(s->ip && s->va < base + MEGAPGSIZE && s->va + s->memsz > base)
+      return -1;
+  }
+  if((pde = walklevel(p->pagetable, base, 1, 1)) == 0 || (*pde & PTE_V))
+    return -1;
+  if((mem = khugealloc()) == 0)
+    return -1;
+  for(int i = 0; i < 512; i++)
+    pagezero(mem + i*PGSIZE);
+  *pde = PA2PTE(mem) | PTE_R | PTE_W | PTE_U | PTE_MEGA | PTE_V;
+  return 0;
+}
+
+// Handle a page fault on an address that is not mapped yet:
+// a page of an mmap region, a page of an exec segment that
+// has not been paged in, or a heap page that sbrk() reserved
+// but nothing has touched. For the heap and bss, a read maps the
+// shared zero page copy-on-write, so the private copy is
+// only made if the page is later written; a write gets a
+// zeroed page straight away. Returns 0 on success, -1 if
+// va is not such an address or memory is exhausted.
+static int
+lazyfault(struct proc *p, uint64 va, int write)
+{
+  pte_t *pte;
+  char *mem;
+
+  // walk() panics on addresses the page table cannot hold.
+  if(va >= MAXVA)
+    return -1;
+
+  if((pte = walk(p->pagetable, va, 0)) != 0 && (*pte & PTE_SWAP))
+    return swapin(p, va);
+
+  struct vma *v = findvma(p, va);
+  if(v != 0)
+    return vmafault(p, v, va, write);
+
+  if(va >= p->sz)
+    return -1;
+
+  if((pte = walk(p->pagetable, va, 0)) != 0 && (*pte & PTE_V))
+    return -1;
+
+  // below the heap, only exec segments are paged in on demand;
+  // the stack and its (non-PTE_U) guard page are always mapped.
+  struct execseg *s = findseg(p, va);
+  if(s != 0){
+    int r = segfault(s, va, write);
+    if(r <= 0)
+      return r;
+    // a bss page: zero-fill it like the heap.
+  }
+
+  if(p->hugeheap && hugefault(p, va) == 0)
+    return 0;
+
+  if(!write){
+    if(mappages(p->pagetable, va, PGSIZE, (uint64)zeropage, PTE_R|PTE_U|PTE_COW) != 0)
+      return -1;
+    incref((uint64)zeropage);
+    return 0;
+  }
+
+  if((mem = ualloc()) == 0)
+    return -1;
+  pagezero(mem);
+
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, PTE_R|PTE_W|PTE_U) != 0){
+    kfree(mem);
+    return -1;
+  }
+
+  return 0;
+}
+
+int
+handle_lazy_fault(uint64 va, int write)
+{
+  struct proc *p = myproc();
+
+  if(p == 0)
+    return -1;
+  va = PGROUNDDOWN(va);
+  if(lazyfault(p, va, write) != 0)
+    return -1;
+  // a hart may cache an invalid PTE, and usertrapret() no
+  // longer flushes the whole TLB.
+  tlbflush(p->pagetable, va);
   return 0;
 }
 
@@ -169,6 +169,9 @@ main(int argc, char *argv[])
 
   balloc(freeblock);
 
+  // make room for the swap area past the file system.
+  wsect(FSSIZE + NSWAPBLOCK - 1, zeroes);
+
   exit(0);
 }
 
@@ -0,0 +1,73 @@
+//
+// page allocator throughput benchmark.
+// runs 1..NCPU worker processes that each repeatedly grow the
+// heap, touch every new page, and shrink it again, so every
+// round trip is one kalloc() and one kfree() per page.
+//
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+#define PGSIZE 4096
+#define NPAGES 64   // pages per sbrk() round trip
+#define ROUNDS 200  // round trips per worker
+
+void
+worker(void)
+{
+  for(int r = 0; r < ROUNDS; r++){
+    char *p = sbrk(NPAGES * PGSIZE);
+    if(p == (char*)0xffffffffffffffffL){
+      printf("allocbench: sbrk failed\n");
+      exit(1);
+    }
+    for(char *q = p; q < p + NPAGES * PGSIZE; q += PGSIZE)
+      *q = r;
+    if(sbrk(-(NPAGES * PGSIZE)) == (char*)0xffffffffffffffffL){
+      printf("allocbench: sbrk(-) failed\n");
+      exit(1);
+    }
+  }
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int maxcpu = NCPU;
+
+  if(argc > 1)
+    maxcpu = atoi(argv[1]);
+
+  printf("allocbench: %d pages x %d rounds per worker\n", NPAGES, ROUNDS);
+  for(int ncpu = 1; ncpu <= maxcpu; ncpu++){
+    int start = uptime();
+    for(int i = 0; i < ncpu; i++){
+      int pid = fork();
+      if(pid < 0){
+        printf("allocbench: fork failed\n");
+        exit(1);
+      }
+      if(pid == 0)
+        worker();
+    }
+    int ok = 1;
+    for(int i = 0; i < ncpu; i++){
+      int xstatus;
+      wait(&xstatus);
+      if(xstatus != 0)
+        ok = 0;
+    }
+    if(!ok)
+      exit(1);
+    int ticks = uptime() - start;
+    if(ticks == 0)
+      ticks = 1;
+    int allocs = ncpu * NPAGES * ROUNDS;
+    // one tick is about 1/10th of a second.
+    printf("workers %d: %d allocs in %d ticks, %d allocs/sec\n",
+           ncpu, allocs, ticks, allocs * 10 / ticks);
+  }
+  exit(0);
+}
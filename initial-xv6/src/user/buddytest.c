@@ -0,0 +1,78 @@
+//
+// tests for the buddy page allocator: memory that is allocated
+// a page at a time and freed again merges back into large
+// blocks. also prints the free blocks of each size.
+//
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+#define PGSIZE 4096
+#define MEGAORDER 9
+
+// print the free block counts, and return the free pages
+// that are in blocks of 2MB or more.
+int
+report(char *when)
+{
+  int nfree[MAXORDER+1];
+  int big = 0, all = 0;
+
+  if(buddystat(nfree) < 0){
+    printf("buddystat failed\n");
+    exit(-1);
+  }
+  printf("  %s:", when);
+  for(int o = 0; o <= MAXORDER; o++){
+    printf(" %d", nfree[o]);
+    all += nfree[o] << o;
+    if(o >= MEGAORDER)
+      big += nfree[o] << o;
+  }
+  printf(" (%d of %d free pages in 2MB blocks)\n", big, all);
+  return big;
+}
+
+int
+main(int argc, char *argv[])
+{
+  printf("buddytest: free blocks of 1, 2, 4, ... pages\n");
+  int before = report("before");
+
+  // take half of memory a page at a time, with a fork to
+  // leave it shared for a while, then give it all back.
+  int n = freepages() / 2;
+  char *p = sbrk(n * PGSIZE);
+  if(p == (char*)-1){
+    printf("sbrk failed\n");
+    exit(-1);
+  }
+  for(int i = 0; i < n; i++)
+    p[(uint64)i * PGSIZE] = i;
+  int pid = fork();
+  if(pid < 0){
+    printf("fork failed\n");
+    exit(-1);
+  }
+  if(pid == 0){
+    for(int i = 0; i < n; i += 2)
+      p[(uint64)i * PGSIZE] = 0;
+    exit(0);
+  }
+  wait(0);
+  report("in use");
+  sbrk(-n * PGSIZE);
+  int after = report("after");
+
+  // each CPU's free list may still hold pages that keep a
+  // couple of 2MB blocks apart.
+  if(after < before - 2 * NCPU * (1 << MEGAORDER)){
+    printf("freed pages did not merge: %d pages in 2MB blocks, was %d\n",
+           after, before);
+    exit(-1);
+  }
+
+  printf("ALL BUDDY TESTS PASSED\n");
+  exit(0);
+}
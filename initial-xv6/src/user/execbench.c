@@ -0,0 +1,105 @@
+//
+// exec() throughput benchmark.
+// forks and execs a small program (echo) and a large one
+// (usertests, which exits at once on a bad flag) over
+// and over, and reports execs per second for each. then
+// reports how much memory each further process running the
+// same binary costs, since text pages are shared.
+//
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define ROUNDS 200
+
+void
+run(char *path, char **argv)
+{
+  int start = uptime();
+  for(int r = 0; r < ROUNDS; r++){
+    int pid = fork();
+    if(pid < 0){
+      printf("execbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      // keep the output quiet.
+      close(1);
+      close(2);
+      open("console", O_RDONLY);
+      open("console", O_RDONLY);
+      exec(path, argv);
+      exit(1);
+    }
+    wait(0);
+  }
+  int ticks = uptime() - start;
+  if(ticks == 0)
+    ticks = 1;
+  // one tick is about 1/10th of a second.
+  printf("%s: %d execs in %d ticks, %d execs/sec\n",
+         path, ROUNDS, ticks, ROUNDS * 10 / ticks);
+}
+
+// start a grep blocked reading from pipe fds.
+void
+startgrep(int *fds)
+{
+  char *argv[] = { "grep", "x", 0 };
+
+  int pid = fork();
+  if(pid < 0){
+    printf("execbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(0);
+    dup(fds[0]);
+    close(fds[0]);
+    close(fds[1]);
+    exec("grep", argv);
+    exit(1);
+  }
+}
+
+void
+sharing(void)
+{
+  enum { NGREP = 4 };
+  int fds[2];
+
+  if(pipe(fds) != 0){
+    printf("execbench: pipe failed\n");
+    exit(1);
+  }
+  int free0 = freepages();
+  startgrep(fds);
+  sleep(5);
+  int free1 = freepages();
+  for(int i = 1; i < NGREP; i++)
+    startgrep(fds);
+  sleep(5);
+  int free2 = freepages();
+
+  // EOF on the pipe lets the greps exit.
+  close(fds[0]);
+  close(fds[1]);
+  for(int i = 0; i < NGREP; i++)
+    wait(0);
+
+  printf("grep: first process %d pages, each further one %d pages\n",
+         free0 - free1, (free1 - free2) / (NGREP - 1));
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *echoargv[] = { "echo", "hi", 0 };
+  char *bigargv[] = { "usertests", "-x", 0 };
+
+  run("echo", echoargv);
+  run("usertests", bigargv);
+  sharing();
+  exit(0);
+}
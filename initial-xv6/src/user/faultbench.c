@@ -0,0 +1,79 @@
+//
+// page fault latency benchmark: times the first write to
+// fresh heap pages (a zero-filled page each) and the first
+// write after fork() to pages shared copy-on-write (a copy
+// each). compare kernels built with make KDEBUG=1 (the default)
+// and KDEBUG=0 to see what filling pages with junk costs.
+//
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define PGSIZE 4096
+#define NPAGES 1024 // pages per round
+#define ROUNDS 20
+
+// print faults per second, taking a tick as 1/10th of a second.
+void
+rate(char *what, int ticks)
+{
+  int faults = NPAGES * ROUNDS;
+
+  if(ticks == 0)
+    ticks = 1;
+  printf("%s: %d faults in %d ticks, %d faults/sec\n",
+         what, faults, ticks, faults * 10 / ticks);
+}
+
+char *
+xsbrk(int n)
+{
+  char *p = sbrk(n);
+  if(p == (char*)0xffffffffffffffffL){
+    printf("faultbench: sbrk failed\n");
+    exit(1);
+  }
+  return p;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *p;
+  int start;
+
+  start = uptime();
+  for(int r = 0; r < ROUNDS; r++){
+    p = xsbrk(NPAGES * PGSIZE);
+    for(int i = 0; i < NPAGES; i++)
+      p[i * PGSIZE] = 1;
+    xsbrk(-(NPAGES * PGSIZE));
+  }
+  rate("zero-fill", uptime() - start);
+
+  p = xsbrk(NPAGES * PGSIZE);
+  for(int i = 0; i < NPAGES; i++)
+    p[i * PGSIZE] = 1;
+  int ticks = 0;
+  for(int r = 0; r < ROUNDS; r++){
+    // only the child's writes are timed; it has the shared
+    // pages, the parent keeps them alive.
+    int pid = fork();
+    if(pid < 0){
+      printf("faultbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      start = uptime();
+      for(int i = 0; i < NPAGES; i++)
+        p[i * PGSIZE] = 2;
+      exit(uptime() - start);
+    }
+    int t;
+    wait(&t);
+    ticks += t;
+  }
+  rate("copy-on-write", ticks);
+
+  exit(0);
+}
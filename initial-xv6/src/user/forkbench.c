@@ -0,0 +1,54 @@
+//
+// fork() latency benchmark.
+// grows the heap to a given size, touches every page, and
+// times fork() of the whole address space. the child exits
+// at once, so this measures setting up the copy-on-write
+// mappings rather than copying any data.
+//
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define PGSIZE 4096
+#define ROUNDS 50
+
+void
+bench(int mb)
+{
+  char *p = sbrk(mb * 1024 * 1024);
+  if(p == (char*)0xffffffffffffffffL){
+    printf("forkbench: sbrk(%d MB) failed\n", mb);
+    exit(1);
+  }
+  for(char *q = p; q < p + mb * 1024 * 1024; q += PGSIZE)
+    *q = 1;
+
+  int start = uptime();
+  for(int r = 0; r < ROUNDS; r++){
+    int pid = fork();
+    if(pid < 0){
+      printf("forkbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      exit(0);
+    wait(0);
+  }
+  int ticks = uptime() - start;
+  if(ticks == 0)
+    ticks = 1;
+  // one tick is about 1/10th of a second.
+  printf("%d MB: %d forks in %d ticks, %d ms per fork\n",
+         mb, ROUNDS, ticks, ticks * 100 / ROUNDS);
+
+  sbrk(-(mb * 1024 * 1024));
+}
+
+int
+main(int argc, char *argv[])
+{
+  bench(1);
+  bench(16);
+  bench(64);
+  exit(0);
+}
@@ -0,0 +1,130 @@
+//
+// memmove() and memset() check and microbenchmark.
+// first checks them against byte-at-a-time loops, including
+// overlapping moves, then reports bytes per cycle for a range
+// of sizes and alignments. the user versions (user/ulib.c)
+// work the same way as the kernel's (kernel/string.c).
+//
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define BUFSIZE (64 * 1024 + 64)
+#define TOTAL   (4 * 1024 * 1024) // bytes moved per measurement
+#define NELEM(x) (sizeof(x)/sizeof((x)[0]))
+
+char src[BUFSIZE], dst[BUFSIZE], ref[BUFSIZE];
+
+static inline uint64
+rdcycle(void)
+{
+  uint64 x;
+  asm volatile("rdcycle %0" : "=r" (x));
+  return x;
+}
+
+void
+fill(char *p, int n, int seed)
+{
+  for(int i = 0; i < n; i++)
+    p[i] = seed + i * 7 + (i >> 8);
+}
+
+void
+refmove(char *d, char *s, int n)
+{
+  if(s < d){
+    while(n-- > 0)
+      d[n] = s[n];
+  } else {
+    for(int i = 0; i < n; i++)
+      d[i] = s[i];
+  }
+}
+
+void
+check(void)
+{
+  enum { N = 512 };
+
+  printf("check: ");
+  for(int n = 0; n < 200; n++){
+    for(int off = 0; off < 16; off++){
+      // overlapping, in both directions, at every distance.
+      for(int dist = -17; dist <= 17; dist++){
+        fill(dst, N, n + off);
+        fill(ref, N, n + off);
+        memmove(dst + 100 + off + dist, dst + 100 + off, n);
+        refmove(ref + 100 + off + dist, ref + 100 + off, n);
+        if(memcmp(dst, ref, N) != 0){
+          printf("memmove of %d bytes from offset %d to %d went wrong\n",
+                 n, off, off + dist);
+          exit(1);
+        }
+      }
+      fill(dst, N, n);
+      fill(ref, N, n);
+      memset(dst + off, off + 1, n);
+      for(int i = 0; i < n; i++)
+        ref[off + i] = off + 1;
+      if(memcmp(dst, ref, N) != 0){
+        printf("memset of %d bytes at offset %d went wrong\n", n, off);
+        exit(1);
+      }
+    }
+  }
+  printf("ok\n");
+}
+
+// print bytes per cycle to two decimal places.
+void
+rate(uint64 bytes, uint64 cycles)
+{
+  if(cycles == 0)
+    cycles = 1;
+  int r = bytes * 100 / cycles;
+  printf(" %d.%d%d", r / 100, r / 10 % 10, r % 10);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int sizes[] = { 16, 64, 256, 4096, 65536 };
+  // destination and source offsets from 8-byte alignment.
+  int aligns[][2] = { {0, 0}, {3, 3}, {0, 1} };
+  uint64 t;
+
+  check();
+
+  printf("bytes/cycle   ");
+  for(int i = 0; i < NELEM(sizes); i++)
+    printf(" %d", sizes[i]);
+  printf("\n");
+
+  fill(src, BUFSIZE, 1);
+  for(int a = 0; a < NELEM(aligns); a++){
+    printf("memmove %d/%d:  ", aligns[a][0], aligns[a][1]);
+    for(int i = 0; i < NELEM(sizes); i++){
+      int n = sizes[i];
+      t = rdcycle();
+      for(int done = 0; done < TOTAL; done += n)
+        memmove(dst + aligns[a][0], src + aligns[a][1], n);
+      rate(TOTAL, rdcycle() - t);
+    }
+    printf("\n");
+  }
+
+  for(int a = 0; a < 2; a++){
+    printf("memset %d:      ", aligns[a][0]);
+    for(int i = 0; i < NELEM(sizes); i++){
+      int n = sizes[i];
+      t = rdcycle();
+      for(int done = 0; done < TOTAL; done += n)
+        memset(dst + aligns[a][0], done, n);
+      rate(TOTAL, rdcycle() - t);
+    }
+    printf("\n");
+  }
+
+  exit(0);
+}
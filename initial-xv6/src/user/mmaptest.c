@@ -0,0 +1,456 @@
+//
+// tests for mmap() and munmap().
+// also compares reading a file through mmap() with read().
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define PGSIZE 4096
+#define FSIZE (2 * PGSIZE + PGSIZE / 2)
+
+char buf[FSIZE];
+
+void
+err(char *why)
+{
+  printf("%s\n", why);
+  exit(-1);
+}
+
+// create f holding FSIZE bytes of a known pattern.
+void
+makefile(char *f)
+{
+  unlink(f);
+  int fd = open(f, O_WRONLY | O_CREATE);
+  if(fd < 0)
+    err("create failed");
+  for(int i = 0; i < FSIZE; i++)
+    buf[i] = 'A' + i % 23;
+  if(write(fd, buf, FSIZE) != FSIZE)
+    err("write failed");
+  close(fd);
+}
+
+// check p against the pattern, and that the rest of the
+// last page is zero.
+void
+checkpattern(char *p)
+{
+  for(int i = 0; i < FSIZE; i++){
+    if(p[i] != 'A' + i % 23){
+      printf("byte %d is %d, not %d\n", i, p[i], 'A' + i % 23);
+      exit(-1);
+    }
+  }
+  for(int i = FSIZE; i < 3 * PGSIZE; i++){
+    if(p[i] != 0)
+      err("past end of file not zero");
+  }
+}
+
+// does running f in a child get it killed?
+int
+killed(void (*f)(char*), char *p)
+{
+  int pid = fork();
+  if(pid < 0)
+    err("fork failed");
+  if(pid == 0){
+    f(p);
+    exit(0);
+  }
+  int xstatus;
+  wait(&xstatus);
+  return xstatus == -1;
+}
+
+void
+touch(char *p)
+{
+  *(volatile char *)p;
+}
+
+void
+scribble(char *p)
+{
+  *p = 'x';
+}
+
+// a private read-only mapping sees the file, is lazily
+// paged in, and may not be written.
+void
+privatetest(void)
+{
+  printf("private: ");
+
+  makefile("mmap.tmp");
+  int fd = open("mmap.tmp", O_RDONLY);
+  if(fd < 0)
+    err("open failed");
+
+  int free0 = freepages();
+  char *p = mmap(0, FSIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED)
+    err("mmap failed");
+  if(free0 - freepages() > 0)
+    err("mmap allocated memory up front");
+  // the mapping holds the file open.
+  close(fd);
+
+  checkpattern(p);
+  if(!killed(scribble, p))
+    err("write to PROT_READ mapping succeeded");
+  if(munmap(p, FSIZE) != 0)
+    err("munmap failed");
+  if(!killed(touch, p))
+    err("unmapped page still readable");
+
+  // writes to a writable private mapping stay private.
+  fd = open("mmap.tmp", O_RDONLY);
+  p = mmap(0, FSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED)
+    err("mmap PROT_WRITE MAP_PRIVATE of O_RDONLY failed");
+  p[0] = 'z';
+  p[PGSIZE] = 'z';
+  if(p[0] != 'z' || p[1] != 'B')
+    err("private write went wrong");
+  munmap(p, FSIZE);
+  if(read(fd, buf, FSIZE) != FSIZE || buf[0] != 'A' || buf[PGSIZE] == 'z')
+    err("private write reached the file");
+  close(fd);
+
+  printf("ok\n");
+}
+
+// writes to a shared mapping reach the file on munmap().
+void
+sharedtest(void)
+{
+  printf("shared: ");
+
+  makefile("mmap.tmp");
+  int fd = open("mmap.tmp", O_RDONLY);
+  if(mmap(0, FSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) != MAP_FAILED)
+    err("mmap PROT_WRITE MAP_SHARED of O_RDONLY succeeded");
+  close(fd);
+
+  fd = open("mmap.tmp", O_RDWR);
+  char *p = mmap(0, FSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED)
+    err("mmap failed");
+  checkpattern(p);
+  for(int i = 0; i < FSIZE; i += 100)
+    p[i] = 'a';
+  // read() into the mapping must count as a write too.
+  int pfd[2];
+  pipe(pfd);
+  write(pfd[1], "xyz", 3);
+  if(read(pfd[0], p + PGSIZE + 1, 3) != 3)
+    err("read into mapping failed");
+  close(pfd[0]);
+  close(pfd[1]);
+  // past the end of the file is not written back.
+  p[FSIZE] = 'q';
+  if(munmap(p, 3 * PGSIZE) != 0)
+    err("munmap failed");
+
+  struct stat st;
+  if(fstat(fd, &st) < 0 || st.size != FSIZE)
+    err("file size changed");
+  if(read(fd, buf, FSIZE) != FSIZE)
+    err("read failed");
+  for(int i = 0; i < FSIZE; i++){
+    char want = 'A' + i % 23;
+    if(i % 100 == 0)
+      want = 'a';
+    if(i >= PGSIZE + 1 && i < PGSIZE + 4)
+      want = "xyz"[i - PGSIZE - 1];
+    if(buf[i] != want){
+      printf("file byte %d is %d, not %d\n", i, buf[i], want);
+      exit(-1);
+    }
+  }
+  close(fd);
+
+  printf("ok\n");
+}
+
+// a child shares MAP_SHARED pages with its parent, but gets
+// its own copies of MAP_PRIVATE ones. exit() writes back.
+void
+forktest(void)
+{
+  printf("fork: ");
+
+  makefile("mmap.tmp");
+  int fd = open("mmap.tmp", O_RDWR);
+  char *sp = mmap(0, FSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  char *pp = mmap(0, FSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(sp == MAP_FAILED || pp == MAP_FAILED)
+    err("mmap failed");
+  close(fd);
+  // fault in the first pages before the fork; the last ones after.
+  sp[0] = '0';
+  pp[0] = '0';
+
+  int pid = fork();
+  if(pid < 0)
+    err("fork failed");
+  if(pid == 0){
+    sp[1] = '1';
+    sp[2 * PGSIZE] = '2';
+    pp[1] = '1';
+    pp[2 * PGSIZE + 1] = 'p';
+    exit(0);
+  }
+  int xstatus;
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(-1);
+  if(sp[0] != '0' || sp[1] != '1' || sp[2 * PGSIZE] != '2')
+    err("parent does not see child's shared writes");
+  // (an untouched private page does see shared writes to the file.)
+  if(pp[0] != '0' || pp[1] != 'B' || pp[2 * PGSIZE + 1] != 'A' + (2 * PGSIZE + 1) % 23)
+    err("parent sees child's private writes");
+
+  // a child that exits without munmap() still writes back.
+  pid = fork();
+  if(pid == 0){
+    sp[3] = '3';
+    exit(0);
+  }
+  wait(0);
+  fd = open("mmap.tmp", O_RDONLY);
+  if(read(fd, buf, 4) != 4 || buf[0] != '0' || buf[1] != '1' || buf[3] != '3')
+    err("exit did not write back");
+  close(fd);
+  munmap(sp, FSIZE);
+  munmap(pp, FSIZE);
+
+  printf("ok\n");
+}
+
+// processes that map a file MAP_SHARED separately share its
+// pages, and keep sharing them after one of them munmap()s or
+// exits, which writes the pages back.
+void
+sharerstest(void)
+{
+  printf("sharers: ");
+
+  makefile("mmap.tmp");
+  int fd = open("mmap.tmp", O_RDWR);
+  char *p = mmap(0, FSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED)
+    err("mmap failed");
+  p[0] = '0';
+
+  int tochild[2], toparent[2];
+  char c;
+  if(pipe(tochild) < 0 || pipe(toparent) < 0)
+    err("pipe failed");
+  int pid = fork();
+  if(pid < 0)
+    err("fork failed");
+  if(pid == 0){
+    close(tochild[1]);
+    close(toparent[0]);
+    // map the file afresh rather than use the inherited mapping.
+    munmap(p, FSIZE);
+    char *q = mmap(0, FSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(q == MAP_FAILED)
+      err("child mmap failed");
+    if(q[0] != '0')
+      err("child does not see parent's write");
+    q[1] = '1';
+    if(munmap(q, FSIZE) != 0)
+      err("child munmap failed");
+    write(toparent[1], "x", 1);
+    if(read(tochild[0], &c, 1) != 1)
+      exit(-1);
+    q = mmap(0, FSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(q == MAP_FAILED)
+      err("child second mmap failed");
+    if(q[1] != '1' || q[2] != '2')
+      err("child does not see parent's write after munmap");
+    q[3] = '3';
+    exit(0);
+  }
+  close(tochild[0]);
+  close(toparent[1]);
+  if(read(toparent[0], &c, 1) != 1)
+    exit(-1);
+  if(p[1] != '1')
+    err("parent does not see child's write");
+  // the child's munmap() wrote this page back; keep writing it.
+  p[2] = '2';
+  write(tochild[1], "x", 1);
+  int xstatus;
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(-1);
+  if(p[3] != '3')
+    err("parent does not see write of child that exited");
+  p[4] = '4';
+  if(munmap(p, FSIZE) != 0)
+    err("munmap failed");
+  close(tochild[1]);
+  close(toparent[0]);
+
+  if(read(fd, buf, 5) != 5 || buf[0] != '0' || buf[1] != '1' ||
+     buf[2] != '2' || buf[3] != '3' || buf[4] != '4')
+    err("file does not hold both processes' writes");
+  close(fd);
+
+  printf("ok\n");
+}
+
+// unmapping part of a region leaves the rest mapped.
+void
+partialtest(void)
+{
+  printf("partial: ");
+
+  makefile("mmap.tmp");
+  int fd = open("mmap.tmp", O_RDONLY);
+  char *p = mmap(0, FSIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED)
+    err("mmap failed");
+  close(fd);
+
+  // punch out the middle page.
+  if(munmap(p + PGSIZE, PGSIZE) != 0)
+    err("munmap of middle page failed");
+  if(!killed(touch, p + PGSIZE))
+    err("unmapped middle page still readable");
+  if(p[0] != 'A' || p[2 * PGSIZE] != 'A' + (2 * PGSIZE) % 23)
+    err("rest of the region went wrong");
+  if(munmap(p, PGSIZE) != 0 || munmap(p + 2 * PGSIZE, PGSIZE) != 0)
+    err("munmap of the rest failed");
+  if(!killed(touch, p))
+    err("unmapped first page still readable");
+
+  // the address range is free again.
+  fd = open("mmap.tmp", O_RDONLY);
+  char *q = mmap(0, FSIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(q == MAP_FAILED)
+    err("second mmap failed");
+  checkpattern(q);
+  munmap(q, FSIZE);
+  close(fd);
+
+  printf("ok\n");
+}
+
+// anonymous shared memory stays shared across fork(), even
+// pages first touched after it; private memory does not.
+void
+anontest(void)
+{
+  enum { N = 16 };
+
+  printf("anonymous: ");
+
+  int free0 = freepages();
+  char *sp = mmap(0, N * PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  char *pp = mmap(0, N * PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(sp == MAP_FAILED || pp == MAP_FAILED)
+    err("mmap failed");
+  // touch only the first half before the fork.
+  for(int i = 0; i < N / 2; i++){
+    if(sp[i * PGSIZE] != 0 || pp[i * PGSIZE] != 0)
+      err("anonymous memory not zero");
+  }
+  sp[0] = -1;
+  pp[0] = -1;
+
+  int pid = fork();
+  if(pid < 0)
+    err("fork failed");
+  if(pid == 0){
+    if(sp[0] != -1 || pp[0] != -1)
+      err("child does not see parent's writes");
+    for(int i = 1; i < N; i++){
+      sp[i * PGSIZE] = i;
+      pp[i * PGSIZE] = i;
+    }
+    exit(0);
+  }
+  int xstatus;
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(-1);
+  for(int i = 1; i < N; i++){
+    if(sp[i * PGSIZE] != i)
+      err("parent does not see child's shared writes");
+    if(pp[i * PGSIZE] != 0)
+      err("parent sees child's private writes");
+  }
+
+  munmap(sp, N * PGSIZE);
+  munmap(pp, N * PGSIZE);
+  // allow for the page-table pages.
+  if(free0 - freepages() > 4){
+    printf("munmap leaked %d pages\n", free0 - freepages());
+    exit(-1);
+  }
+
+  printf("ok\n");
+}
+
+// time reading the file through read() and through mmap().
+void
+bench(void)
+{
+  enum { ROUNDS = 2000 };
+
+  makefile("mmap.tmp");
+  int fd = open("mmap.tmp", O_RDONLY);
+
+  int start = uptime();
+  int sum = 0;
+  for(int r = 0; r < ROUNDS; r++){
+    read(fd, buf, FSIZE);
+    for(int i = 0; i < FSIZE; i += 64)
+      sum += buf[i];
+    close(fd);
+    fd = open("mmap.tmp", O_RDONLY);
+  }
+  int rticks = uptime() - start;
+
+  start = uptime();
+  for(int r = 0; r < ROUNDS; r++){
+    char *p = mmap(0, FSIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+    for(int i = 0; i < FSIZE; i += 64)
+      sum -= p[i];
+    munmap(p, FSIZE);
+  }
+  int mticks = uptime() - start;
+  close(fd);
+  if(sum != 0)
+    err("read() and mmap() saw different data");
+
+  printf("bench: %d reads of %d bytes: read() %d ticks, mmap() %d ticks\n",
+         ROUNDS, FSIZE, rticks, mticks);
+}
+
+int
+main(int argc, char *argv[])
+{
+  privatetest();
+  sharedtest();
+  forktest();
+  sharerstest();
+  partialtest();
+  anontest();
+  bench();
+  unlink("mmap.tmp");
+
+  printf("ALL MMAP TESTS PASSED\n");
+
+  exit(0);
+}
@@ -0,0 +1,337 @@
+//
+// tests for lazy (zero-fill-on-demand) sbrk().
+// also reports how sbrk() latency and resident
+// memory scale with the size of the request.
+//
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define PGSIZE 4096
+#define BIG (64 * 1024 * 1024)
+
+char *
+xsbrk(int n)
+{
+  char *p = sbrk(n);
+  if(p == (char*)0xffffffffffffffffL){
+    printf("sbrk(%d) failed\n", n);
+    exit(-1);
+  }
+  return p;
+}
+
+// a large sbrk() should not allocate memory up front,
+// and should cost only the pages actually touched.
+void
+sparsetest()
+{
+  printf("sparse: ");
+
+  int free0 = freepages();
+  char *p = xsbrk(BIG);
+  int free1 = freepages();
+  if(free0 - free1 > 4){
+    printf("sbrk(%d) allocated %d pages\n", BIG, free0 - free1);
+    exit(-1);
+  }
+
+  // touch every 16th page.
+  int touched = 0;
+  for(char *q = p; q < p + BIG; q += 16 * PGSIZE){
+    if(*q != 0){
+      printf("untouched page not zero\n");
+      exit(-1);
+    }
+    *q = 1;
+    touched++;
+  }
+  int used = free1 - freepages();
+  // allow for the page-table pages.
+  if(used < touched || used > touched + touched / 8 + 8){
+    printf("touched %d pages but %d allocated\n", touched, used);
+    exit(-1);
+  }
+
+  xsbrk(-BIG);
+  // page-table pages stay allocated until exit.
+  if(freepages() < free0 - (BIG / (512 * PGSIZE) + 4)){
+    printf("sbrk(-%d) leaked %d pages\n", BIG, free0 - freepages());
+    exit(-1);
+  }
+
+  printf("ok\n");
+}
+
+// reading untouched pages should map the shared zero page,
+// not allocate; the first write makes a private copy.
+void
+zeropagetest()
+{
+  printf("zeropage: ");
+
+  int free0 = freepages();
+  char *p = xsbrk(BIG);
+  int sum = 0;
+  for(char *q = p; q < p + BIG; q += PGSIZE)
+    sum += *q;
+  if(sum != 0){
+    printf("untouched pages not zero\n");
+    exit(-1);
+  }
+  // only page-table pages may have been allocated.
+  int used = free0 - freepages();
+  if(used > BIG / (512 * PGSIZE) + 4){
+    printf("reading %d untouched pages allocated %d pages\n",
+           BIG / PGSIZE, used);
+    exit(-1);
+  }
+
+  // writes get private pages; the rest still read zero.
+  p[0] = 1;
+  p[5 * PGSIZE] = 2;
+  if(p[0] != 1 || p[5 * PGSIZE] != 2 || p[PGSIZE] != 0 || p[4 * PGSIZE] != 0){
+    printf("wrong content after write\n");
+    exit(-1);
+  }
+  if(free0 - freepages() != used + 2){
+    printf("two writes allocated %d pages\n", free0 - freepages() - used);
+    exit(-1);
+  }
+  xsbrk(-BIG);
+
+  printf("ok\n");
+}
+
+// shrinking and regrowing must hand back zeroed pages.
+void
+regrowtest()
+{
+  printf("regrow: ");
+
+  char *p = xsbrk(8 * PGSIZE);
+  for(int i = 0; i < 8; i++)
+    p[i * PGSIZE] = 'x';
+  xsbrk(-8 * PGSIZE);
+  p = xsbrk(8 * PGSIZE);
+  for(int i = 0; i < 8; i++){
+    if(p[i * PGSIZE] != 0){
+      printf("regrown page %d not zero\n", i);
+      exit(-1);
+    }
+  }
+  xsbrk(-8 * PGSIZE);
+
+  printf("ok\n");
+}
+
+// system calls must fault in untouched pages that they
+// read from (write()) or write to (read(), pipe()).
+void
+syscalltest()
+{
+  int fds[2];
+
+  printf("syscall: ");
+
+  char *p = xsbrk(4 * PGSIZE);
+  if(pipe(fds) != 0){
+    printf("pipe() failed\n");
+    exit(-1);
+  }
+  // copyin from an untouched page.
+  if(write(fds[1], p + PGSIZE, 16) != 16){
+    printf("write from lazy page failed\n");
+    exit(-1);
+  }
+  // copyout to an untouched page.
+  if(read(fds[0], p + 2 * PGSIZE + 100, 16) != 16){
+    printf("read into lazy page failed\n");
+    exit(-1);
+  }
+  for(int i = 0; i < 16; i++){
+    if(p[2 * PGSIZE + 100 + i] != 0){
+      printf("wrong content\n");
+      exit(-1);
+    }
+  }
+  // copyout to an untouched page, from the kernel side.
+  if(pipe((int*)(p + 3 * PGSIZE)) != 0){
+    printf("pipe() into lazy page failed\n");
+    exit(-1);
+  }
+  close(((int*)(p + 3 * PGSIZE))[0]);
+  close(((int*)(p + 3 * PGSIZE))[1]);
+  close(fds[0]);
+  close(fds[1]);
+  xsbrk(-4 * PGSIZE);
+
+  // just past the end of the heap is still an error.
+  int fd = open("sbrktest.tmp", O_CREATE|O_WRONLY);
+  if(fd < 0){
+    printf("open failed\n");
+    exit(-1);
+  }
+  if(write(fd, sbrk(0), 16) != -1){
+    printf("write from beyond sbrk(0) succeeded\n");
+    exit(-1);
+  }
+  close(fd);
+  unlink("sbrktest.tmp");
+
+  printf("ok\n");
+}
+
+// a child must see the parent's touched pages and
+// zeroes for the untouched ones.
+void
+forktest()
+{
+  printf("fork: ");
+
+  char *p = xsbrk(16 * PGSIZE);
+  for(int i = 0; i < 16; i += 2)
+    p[i * PGSIZE] = i + 1;
+
+  int pid = fork();
+  if(pid < 0){
+    printf("fork failed\n");
+    exit(-1);
+  }
+  if(pid == 0){
+    for(int i = 0; i < 16; i++){
+      int want = (i % 2 == 0) ? i + 1 : 0;
+      if(p[i * PGSIZE] != want){
+        printf("child saw wrong content at page %d\n", i);
+        exit(-1);
+      }
+      p[i * PGSIZE] = 100;
+    }
+    exit(0);
+  }
+  int xstatus;
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(-1);
+  for(int i = 0; i < 16; i++){
+    int want = (i % 2 == 0) ? i + 1 : 0;
+    if(p[i * PGSIZE] != want){
+      printf("parent saw wrong content at page %d\n", i);
+      exit(-1);
+    }
+  }
+  xsbrk(-16 * PGSIZE);
+
+  printf("ok\n");
+}
+
+// with hugeheap() on, an aligned untouched 2MB of heap gets
+// one 2MB page. a fork's COW write and a shrink into the middle
+// of it must split it without disturbing the other pages.
+void
+hugetest()
+{
+  enum { MEGA = 512 * PGSIZE };
+
+  printf("huge: ");
+
+  // line the heap up on a 2MB boundary.
+  uint64 top = (uint64)sbrk(0);
+  xsbrk((MEGA - top % MEGA) % MEGA);
+  char *p = xsbrk(2 * MEGA);
+
+  hugeheap(1);
+  int free0 = freepages();
+  p[0] = 1;
+  int used = free0 - freepages();
+  for(int i = 0; i < 2 * MEGA; i += PGSIZE){
+    if(p[i] != (i == 0)){
+      printf("wrong content at %d\n", i);
+      exit(-1);
+    }
+    p[i] = i / PGSIZE;
+  }
+
+  int pid = fork();
+  if(pid < 0){
+    printf("fork failed\n");
+    exit(-1);
+  }
+  if(pid == 0){
+    // COW write into the middle of the 2MB page.
+    p[100 * PGSIZE] = -1;
+    for(int i = 0; i < 2 * MEGA; i += PGSIZE){
+      char want = (i == 100 * PGSIZE) ? -1 : i / PGSIZE;
+      if(p[i] != want){
+        printf("child saw wrong content at %d\n", i);
+        exit(-1);
+      }
+    }
+    exit(0);
+  }
+  int xstatus;
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(-1);
+
+  // shrink into the middle of the first 2MB.
+  xsbrk(-(MEGA + MEGA / 2));
+  for(int i = 0; i < MEGA / 2; i += PGSIZE){
+    if(p[i] != (char)(i / PGSIZE)){
+      printf("parent saw wrong content at %d\n", i);
+      exit(-1);
+    }
+  }
+  xsbrk(-(MEGA / 2));
+  hugeheap(0);
+
+  printf("ok (first touch took %d pages)\n", used);
+}
+
+// report sbrk() latency and resident pages as the
+// request size grows.
+void
+scaling()
+{
+  enum { ROUNDS = 100 };
+
+  printf("scaling:\n");
+  for(int npages = 1; npages <= BIG / PGSIZE; npages *= 8){
+    int start = uptime();
+    for(int r = 0; r < ROUNDS; r++){
+      xsbrk(npages * PGSIZE);
+      xsbrk(-npages * PGSIZE);
+    }
+    int ticks = uptime() - start;
+
+    int free0 = freepages();
+    char *p = xsbrk(npages * PGSIZE);
+    int reserved = free0 - freepages();
+    // touch a quarter of the pages.
+    for(int i = 0; i < npages; i += 4)
+      p[i * PGSIZE] = 1;
+    int resident = free0 - freepages();
+    xsbrk(-npages * PGSIZE);
+
+    printf("  %d pages: %d sbrk round trips in %d ticks, "
+           "%d pages resident after sbrk, %d after touching 1/4\n",
+           npages, ROUNDS, ticks, reserved, resident);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  sparsetest();
+  zeropagetest();
+  regrowtest();
+  syscalltest();
+  forktest();
+  hugetest();
+  scaling();
+
+  printf("ALL SBRK TESTS PASSED\n");
+
+  exit(0);
+}
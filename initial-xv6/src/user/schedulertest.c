@@ -6,16 +6,30 @@
 #define NFORK 10
 #define IO 5
 
+#if defined(SCHED_MLFQ)
+#define POLICY "MLFQ"
+#elif defined(SCHED_STRIDE)
+#define POLICY "stride"
+#elif defined(SCHED_LOTTERY)
+#define POLICY "lottery"
+#else
+#define POLICY "round robin"
+#endif
+
 int main()
 {
   int n, pid;
   int wtime, rtime;
   int twtime = 0, trtime = 0;
+  int iopids[IO];
+  int iortime = 0, iowtime = 0;
   for (n = 0; n < NFORK; n++)
   {
     pid = fork();
     if (pid < 0)
       break;
+    if (n < IO)
+      iopids[n] = pid;
     if (pid == 0)
     {
       if (n < IO)
@@ -34,12 +48,24 @@ int main()
   }
   for (; n > 0; n--)
   {
-    if (waitx(0, &wtime, &rtime) >= 0)
+    if ((pid = waitx(0, &wtime, &rtime)) >= 0)
     {
       trtime += rtime;
       twtime += wtime;
+      for (int i = 0; i < IO; i++)
+      {
+        if (iopids[i] == pid)
+        {
+          iortime += rtime;
+          iowtime += wtime;
+        }
+      }
     }
   }
+  printf("Scheduler: %s\n", POLICY);
+  printf("IO bound:  average rtime %d,  wtime %d\n", iortime / IO, iowtime / IO);
+  printf("CPU bound: average rtime %d,  wtime %d\n",
+         (trtime - iortime) / (NFORK - IO), (twtime - iowtime) / (NFORK - IO));
   printf("Average rtime %d,  wtime %d\n", trtime / NFORK, twtime / NFORK);
   exit(0);
 }
\ No newline at end of file
@@ -0,0 +1,115 @@
+//
+// test for the proportional-share schedulers (make SCHEDULER=STRIDE
+// or SCHEDULER=LOTTERY): CPU-bound processes with 10, 20 and 30
+// tickets should get 1/6, 2/6 and 3/6 of the CPU time.
+// NCPU processes of each kind keep every CPU busy.
+//
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+#define NCLASS 3
+#define WINDOW 100  // ticks to compete for
+
+#if defined(SCHED_STRIDE)
+#define BOUND 5     // percentage points off the ticket ratio
+#elif defined(SCHED_LOTTERY)
+#define BOUND 10    // random draws converge more slowly
+#endif
+
+int tickets[NCLASS] = { 10, 20, 30 };
+
+void
+err(char *why)
+{
+  printf("%s\n", why);
+  exit(-1);
+}
+
+// with t tickets, spin until the tick read from gfd.
+void
+child(int t, int gfd)
+{
+  int end;
+
+  if(settickets(t) < 0)
+    exit(-1);
+  if(read(gfd, &end, sizeof(end)) != sizeof(end))
+    exit(-1);
+  while(uptime() < end)
+    for(volatile int i = 0; i < 100000; i++)
+      ;
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+#ifndef BOUND
+  printf("sharetest: needs make SCHEDULER=STRIDE or SCHEDULER=LOTTERY\n");
+  exit(0);
+#else
+  int pids[NCLASS][NCPU];
+  int rtime[NCLASS] = { 0 };
+  int go[2], total = 0, alltickets = 0;
+
+  printf("sharetest: ");
+
+  if(settickets(0) != -1)
+    err("settickets(0) succeeded");
+
+  if(pipe(go) < 0)
+    err("pipe failed");
+  for(int c = 0; c < NCLASS; c++){
+    for(int i = 0; i < NCPU; i++){
+      pids[c][i] = fork();
+      if(pids[c][i] < 0)
+        err("fork failed");
+      if(pids[c][i] == 0){
+        close(go[1]);
+        child(tickets[c], go[0]);
+      }
+    }
+  }
+
+  // start them together.
+  int end = uptime() + WINDOW;
+  for(int i = 0; i < NCLASS * NCPU; i++)
+    write(go[1], &end, sizeof(end));
+
+  for(int n = 0; n < NCLASS * NCPU; n++){
+    int wtime, rt, xstatus;
+    int pid = waitx(&xstatus, &wtime, &rt);
+    if(pid < 0 || xstatus != 0)
+      err("child failed");
+    for(int c = 0; c < NCLASS; c++)
+      for(int i = 0; i < NCPU; i++)
+        if(pids[c][i] == pid)
+          rtime[c] += rt;
+    total += rt;
+  }
+  if(total == 0)
+    err("children did not run");
+
+  for(int c = 0; c < NCLASS; c++)
+    alltickets += tickets[c];
+  int ok = 1;
+  for(int c = 0; c < NCLASS; c++){
+    int want = tickets[c] * 100 / alltickets;
+    int got = rtime[c] * 100 / total;
+    if(got < want - BOUND || got > want + BOUND)
+      ok = 0;
+  }
+  printf(ok ? "ok\n" : "shares off by more than %d points\n", BOUND);
+  for(int c = 0; c < NCLASS; c++)
+    printf("  %d tickets: %d of %d ticks, %d%%, want %d%%\n", tickets[c],
+           rtime[c], total, rtime[c] * 100 / total,
+           tickets[c] * 100 / alltickets);
+  if(!ok)
+    exit(-1);
+
+  printf("ALL SHARE TESTS PASSED\n");
+  exit(0);
+#endif
+}
@@ -0,0 +1,146 @@
+//
+// producer/consumer bandwidth benchmark.
+// moves TOTAL bytes from a forked producer to its parent,
+// first through a pipe and then through a ring buffer in
+// anonymous shared memory, which the consumer reads in place.
+//
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define PGSIZE 4096
+#define CHUNK  4096              // bytes per message
+#define NSLOT  64                // messages the ring holds
+#define TOTAL  (8 * 1024 * 1024) // bytes moved per run
+
+char buf[CHUNK];
+
+struct ring {
+  volatile int head;  // messages written
+  volatile int tail;  // messages read
+};
+
+// fill a message the same way for both transports.
+void
+produce(char *p, int n)
+{
+  memset(p, n, CHUNK);
+}
+
+// check a message, reading every word of it.
+void
+consume(char *p, int n)
+{
+  uint64 want = (uchar)n * 0x0101010101010101UL;
+
+  for(uint64 *q = (uint64*)p; q < (uint64*)(p + CHUNK); q++){
+    if(*q != want){
+      printf("shmbench: message %d corrupt\n", n);
+      exit(1);
+    }
+  }
+}
+
+void
+report(char *what, int ticks)
+{
+  if(ticks == 0)
+    ticks = 1;
+  // one tick is about 1/10th of a second.
+  printf("%s: %d KB in %d ticks, %d KB/sec\n",
+         what, TOTAL / 1024, ticks, TOTAL / 1024 * 10 / ticks);
+}
+
+void
+viapipe(void)
+{
+  int fds[2];
+
+  if(pipe(fds) < 0){
+    printf("shmbench: pipe failed\n");
+    exit(1);
+  }
+  int start = uptime();
+  int pid = fork();
+  if(pid < 0){
+    printf("shmbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(int n = 0; n < TOTAL / CHUNK; n++){
+      produce(buf, n);
+      if(write(fds[1], buf, CHUNK) != CHUNK){
+        printf("shmbench: write failed\n");
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  for(int n = 0; n < TOTAL / CHUNK; n++){
+    for(int got = 0; got < CHUNK; ){
+      int r = read(fds[0], buf + got, CHUNK - got);
+      if(r <= 0){
+        printf("shmbench: read failed\n");
+        exit(1);
+      }
+      got += r;
+    }
+    consume(buf, n);
+  }
+  close(fds[0]);
+  wait(0);
+  report("pipe", uptime() - start);
+}
+
+void
+viashm(void)
+{
+  char *p = mmap(0, PGSIZE + NSLOT * CHUNK, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED){
+    printf("shmbench: mmap failed\n");
+    exit(1);
+  }
+  struct ring *r = (struct ring*)p;
+  char *slot = p + PGSIZE;
+
+  int start = uptime();
+  int pid = fork();
+  if(pid < 0){
+    printf("shmbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    for(int n = 0; n < TOTAL / CHUNK; n++){
+      while(r->head - r->tail == NSLOT)
+        ;
+      produce(slot + (n % NSLOT) * CHUNK, n);
+      __sync_synchronize();
+      r->head = n + 1;
+    }
+    exit(0);
+  }
+  for(int n = 0; n < TOTAL / CHUNK; n++){
+    while(r->tail == r->head)
+      ;
+    __sync_synchronize();
+    consume(slot + (n % NSLOT) * CHUNK, n);
+    __sync_synchronize();
+    r->tail = n + 1;
+  }
+  wait(0);
+  report("shared memory", uptime() - start);
+  munmap(p, PGSIZE + NSLOT * CHUNK);
+}
+
+int
+main(int argc, char *argv[])
+{
+  printf("shmbench: %d byte messages\n", CHUNK);
+  viapipe();
+  viashm();
+  exit(0);
+}
@@ -0,0 +1,90 @@
+//
+// tests for the kernel's slab-allocated pipes and files:
+// more files can be open than the old fixed table held, and
+// a pipe costs a fraction of a page.
+//
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define NCHILD 12
+#define NPIPE   5  // per child: 10 fds, plus 0, 1, 2 and 2 more
+
+void
+err(char *why)
+{
+  printf("%s\n", why);
+  exit(-1);
+}
+
+// make NPIPE pipes, report the pages they took on rfd, and
+// hold them open until gfd is closed.
+void
+child(int rfd, int gfd)
+{
+  int fds[NPIPE][2];
+  int before, used;
+  char c;
+
+  before = freepages();
+  for(int i = 0; i < NPIPE; i++){
+    if(pipe(fds[i]) < 0){
+      used = -1;
+      write(rfd, &used, sizeof(used));
+      exit(-1);
+    }
+  }
+  used = before - freepages();
+  write(rfd, &used, sizeof(used));
+  read(gfd, &c, 1);
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int report[2], go[2];
+  int used, total = 0;
+
+  printf("slabtest: ");
+
+  if(pipe(report) < 0 || pipe(go) < 0)
+    err("pipe failed");
+
+  // one child at a time, so that only it is allocating
+  // while it measures.
+  for(int i = 0; i < NCHILD; i++){
+    int pid = fork();
+    if(pid < 0)
+      err("fork failed");
+    if(pid == 0){
+      close(report[0]);
+      close(go[1]);
+      child(report[1], go[0]);
+    }
+    if(read(report[0], &used, sizeof(used)) != sizeof(used) || used < 0)
+      err("pipe failed with many files open");
+    total += used;
+  }
+
+  close(go[1]);
+  for(int i = 0; i < NCHILD; i++){
+    int xstatus;
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(-1);
+  }
+
+  // a page each before; allow for slabs of files too.
+  if(total * 2 > NCHILD * NPIPE){
+    printf("%d pipes took %d pages\n", NCHILD * NPIPE, total);
+    exit(-1);
+  }
+
+  printf("ok\n");
+  printf("  %d pipes (%d open files) took %d pages\n",
+         NCHILD * NPIPE, NCHILD * NPIPE * 2, total);
+
+  printf("ALL SLAB TESTS PASSED\n");
+  exit(0);
+}
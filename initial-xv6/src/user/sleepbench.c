@@ -0,0 +1,100 @@
+//
+// cost of processes asleep in sleep().
+// measures a CPU-bound loop, pipe round trips (each a
+// wakeup()), and the accuracy of sleep(1), first alone and then
+// with NSLEEP processes in a long sleep(). a sleeper should cost
+// nothing until its time comes.
+//
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define NSLEEP 60
+#define SPIN   200000000  // iterations of the CPU-bound loop
+#define TRIPS  10000      // pipe round trips
+#define NAPS   20         // sleep(1)s
+
+void
+measure(char *when)
+{
+  int start, ticks, fds[2], back[2];
+  char c = 0;
+
+  printf("%s:\n", when);
+
+  start = uptime();
+  for(volatile int i = 0; i < SPIN; i++)
+    ;
+  printf("  spin: %d ticks\n", uptime() - start);
+
+  if(pipe(fds) < 0 || pipe(back) < 0){
+    printf("sleepbench: pipe failed\n");
+    exit(1);
+  }
+  int pid = fork();
+  if(pid < 0){
+    printf("sleepbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    for(int i = 0; i < TRIPS; i++){
+      if(read(fds[0], &c, 1) != 1 || write(back[1], &c, 1) != 1)
+        exit(1);
+    }
+    exit(0);
+  }
+  start = uptime();
+  for(int i = 0; i < TRIPS; i++){
+    if(write(fds[1], &c, 1) != 1 || read(back[0], &c, 1) != 1){
+      printf("sleepbench: pipe i/o failed\n");
+      exit(1);
+    }
+  }
+  ticks = uptime() - start;
+  if(ticks == 0)
+    ticks = 1;
+  // one tick is about 1/10th of a second.
+  printf("  pipe: %d round trips in %d ticks, %d trips/sec\n",
+         TRIPS, ticks, TRIPS * 10 / ticks);
+  wait(0);
+  close(fds[0]);
+  close(fds[1]);
+  close(back[0]);
+  close(back[1]);
+
+  start = uptime();
+  for(int i = 0; i < NAPS; i++)
+    sleep(1);
+  printf("  %d sleep(1)s: %d ticks\n", NAPS, uptime() - start);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int pids[NSLEEP];
+
+  measure("no sleepers");
+
+  for(int i = 0; i < NSLEEP; i++){
+    pids[i] = fork();
+    if(pids[i] < 0){
+      printf("sleepbench: fork failed\n");
+      exit(1);
+    }
+    if(pids[i] == 0){
+      sleep(1000000);
+      exit(0);
+    }
+  }
+  // let them all get to sleep.
+  sleep(2);
+
+  printf("\n");
+  measure("with sleepers");
+
+  for(int i = 0; i < NSLEEP; i++)
+    kill(pids[i]);
+  for(int i = 0; i < NSLEEP; i++)
+    wait(0);
+  exit(0);
+}
@@ -0,0 +1,103 @@
+//
+// process creation benchmark.
+// runs the pipeline  cat README | grep x | wc  over and over,
+// once starting each stage with fork() and exec() as sh used
+// to, and once with spawn(), and reports pipelines per second.
+// the benchmark first grows its heap, as a long-running shell's
+// would, so that fork() has an address space to set up.
+//
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define ROUNDS 50
+#define HEAP (4 * 1024 * 1024)
+
+char *catargv[] = { "cat", "README", 0 };
+char *grepargv[] = { "grep", "x", 0 };
+char *wcargv[] = { "wc", 0 };
+
+// start argv[0] with in, out as its standard input and output.
+void
+forkexec(char **argv, int in, int out)
+{
+  int pid = fork();
+  if(pid < 0){
+    printf("spawnbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(0);
+    dup(in);
+    close(1);
+    dup(out);
+    for(int fd = 3; fd < 16; fd++)
+      close(fd);
+    exec(argv[0], argv);
+    exit(1);
+  }
+}
+
+void
+spawnexec(char **argv, int in, int out)
+{
+  int fds[3] = { in, out, 2 };
+
+  if(spawn(argv[0], argv, fds) < 0){
+    printf("spawnbench: spawn %s failed\n", argv[0]);
+    exit(1);
+  }
+}
+
+void
+run(char *name, void (*start)(char**, int, int), int null)
+{
+  int p1[2], p2[2];
+
+  int t0 = uptime();
+  for(int r = 0; r < ROUNDS; r++){
+    if(pipe(p1) < 0 || pipe(p2) < 0){
+      printf("spawnbench: pipe failed\n");
+      exit(1);
+    }
+    start(catargv, 0, p1[1]);
+    start(grepargv, p1[0], p2[1]);
+    start(wcargv, p2[0], null);
+    close(p1[0]);
+    close(p1[1]);
+    close(p2[0]);
+    close(p2[1]);
+    for(int i = 0; i < 3; i++)
+      wait(0);
+  }
+  int ticks = uptime() - t0;
+  if(ticks == 0)
+    ticks = 1;
+  // one tick is about 1/10th of a second.
+  printf("%s: %d pipelines in %d ticks, %d processes/sec\n",
+         name, ROUNDS, ticks, 3 * ROUNDS * 10 / ticks);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *heap = sbrk(HEAP);
+  if(heap == (char*)0xffffffffffffffffL){
+    printf("spawnbench: sbrk failed\n");
+    exit(1);
+  }
+  for(char *q = heap; q < heap + HEAP; q += 4096)
+    *q = 1;
+
+  // wc's output goes nowhere: writes to a read-only fd fail.
+  int null = open("console", O_RDONLY);
+  if(null < 0){
+    printf("spawnbench: open console failed\n");
+    exit(1);
+  }
+
+  run("fork+exec", forkexec, null);
+  run("spawn", spawnexec, null);
+  exit(0);
+}
@@ -0,0 +1,114 @@
+//
+// tests for swapping: touch more memory than is free, and
+// check that nothing is lost. also reports how many pages
+// went out to swap and came back in, and how long it took.
+//
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define PGSIZE 4096
+#define EXTRA 1024 // pages beyond what is free
+
+char *
+xsbrk(int n)
+{
+  char *p = sbrk(n);
+  if(p == (char*)0xffffffffffffffffL){
+    printf("sbrk(%d) failed\n", n);
+    exit(-1);
+  }
+  return p;
+}
+
+// check that page i of p still holds what fill() wrote.
+void
+check(char *p, int i, char *who)
+{
+  int *w = (int*)(p + (uint64)i * PGSIZE);
+  if(w[0] != i || w[PGSIZE / sizeof(int) - 1] != ~i){
+    printf("%s: page %d lost its content\n", who, i);
+    exit(-1);
+  }
+}
+
+void
+overcommit(void)
+{
+  int st0[2], st1[2];
+
+  printf("overcommit: ");
+
+  int n = freepages() + EXTRA;
+  swapstat(st0);
+  int start = uptime();
+
+  char *p = xsbrk(n * PGSIZE);
+  for(int i = 0; i < n; i++){
+    int *w = (int*)(p + (uint64)i * PGSIZE);
+    w[0] = i;
+    w[PGSIZE / sizeof(int) - 1] = ~i;
+  }
+  // newest first: the oldest pages are the ones in swap.
+  for(int i = n - 1; i >= 0; i--)
+    check(p, i, "parent");
+
+  // a child sees the swapped pages too, and its
+  // writes do not reach the parent.
+  int pid = fork();
+  if(pid < 0){
+    printf("fork failed\n");
+    exit(-1);
+  }
+  if(pid == 0){
+    for(int i = 0; i < n; i += 64){
+      check(p, i, "child");
+      *(int*)(p + (uint64)i * PGSIZE) = -1;
+    }
+    exit(0);
+  }
+  int xstatus;
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(-1);
+  for(int i = 0; i < n; i += 64)
+    check(p, i, "parent after fork");
+
+  int ticks = uptime() - start;
+  swapstat(st1);
+  xsbrk(-n * PGSIZE);
+
+  printf("ok\n");
+  printf("  touched %d pages (%d more than were free) in %d ticks: "
+         "%d swapped out, %d swapped in\n",
+         n, EXTRA, ticks, st1[0] - st0[0], st1[1] - st0[1]);
+}
+
+// freeing swapped-out memory must free its swap space: doing
+// the same again must not run out.
+void
+reuse(void)
+{
+  printf("reuse: ");
+
+  for(int r = 0; r < 3; r++){
+    int n = freepages() + EXTRA;
+    char *p = xsbrk(n * PGSIZE);
+    for(int i = 0; i < n; i++)
+      p[(uint64)i * PGSIZE] = 1;
+    xsbrk(-n * PGSIZE);
+  }
+
+  printf("ok\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  overcommit();
+  reuse();
+
+  printf("ALL SWAP TESTS PASSED\n");
+
+  exit(0);
+}
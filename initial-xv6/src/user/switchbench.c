@@ -0,0 +1,89 @@
+//
+// context switch benchmark.
+// runs 1..NCPU pairs of processes that pass a byte back and
+// forth over two pipes, so each trip blocks one process and
+// wakes the other: two sleeps, two wakeups and two switches.
+// with one run queue per CPU the pairs should not slow each
+// other down.
+//
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+#define TRIPS 5000  // round trips per pair
+
+// bounce a byte TRIPS times: read it on rfd, write it to wfd.
+// the side with first set sends it first.
+void
+player(int rfd, int wfd, int first)
+{
+  char c = 0;
+
+  if(first && write(wfd, &c, 1) != 1)
+    exit(1);
+  for(int i = 0; i < TRIPS; i++){
+    if(read(rfd, &c, 1) != 1)
+      exit(1);
+    if((!first || i < TRIPS - 1) && write(wfd, &c, 1) != 1)
+      exit(1);
+  }
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int maxcpu = NCPU;
+
+  if(argc > 1)
+    maxcpu = atoi(argv[1]);
+
+  printf("switchbench: %d round trips per pair\n", TRIPS);
+  for(int npair = 1; npair <= maxcpu; npair++){
+    int start = uptime();
+    for(int i = 0; i < npair; i++){
+      int ping[2], pong[2];
+      if(pipe(ping) < 0 || pipe(pong) < 0){
+        printf("switchbench: pipe failed\n");
+        exit(1);
+      }
+      for(int side = 0; side < 2; side++){
+        int pid = fork();
+        if(pid < 0){
+          printf("switchbench: fork failed\n");
+          exit(1);
+        }
+        if(pid == 0){
+          if(side == 0)
+            player(pong[0], ping[1], 1);
+          else
+            player(ping[0], pong[1], 0);
+        }
+      }
+      close(ping[0]);
+      close(ping[1]);
+      close(pong[0]);
+      close(pong[1]);
+    }
+    int ok = 1;
+    for(int i = 0; i < 2 * npair; i++){
+      int xstatus;
+      wait(&xstatus);
+      if(xstatus != 0)
+        ok = 0;
+    }
+    if(!ok){
+      printf("switchbench: a player failed\n");
+      exit(1);
+    }
+    int ticks = uptime() - start;
+    if(ticks == 0)
+      ticks = 1;
+    int switches = npair * TRIPS * 2;
+    // one tick is about 1/10th of a second.
+    printf("pairs %d: %d switches in %d ticks, %d switches/sec\n",
+           npair, switches, ticks, switches * 10 / ticks);
+  }
+  exit(0);
+}
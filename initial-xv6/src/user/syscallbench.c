@@ -0,0 +1,68 @@
+//
+// system call round-trip benchmark.
+// times a run of getpid() calls, each a full trip through
+// the trampoline and back, including the satp switches.
+// then times calls that copy to and from user memory: 512-byte
+// pipe writes and reads (copyin() and copyout()), and open()s
+// of a long path that does not exist (copyinstr()).
+//
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NCALLS 200000
+
+// print calls per second, taking a tick as 1/10th of a second.
+void
+rate(char *what, int n, int start)
+{
+  int ticks = uptime() - start;
+  if(ticks == 0)
+    ticks = 1;
+  printf("syscallbench: %d %s in %d ticks, %d calls/sec\n",
+         n, what, ticks, n * 10 / ticks);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = NCALLS;
+  int start;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+
+  start = uptime();
+  for(int i = 0; i < n; i++)
+    getpid();
+  rate("getpid() calls", n, start);
+
+  static char buf[512];
+  int fds[2];
+  if(pipe(fds) < 0){
+    printf("syscallbench: pipe failed\n");
+    exit(1);
+  }
+  start = uptime();
+  for(int i = 0; i < n / 2; i++){
+    if(write(fds[1], buf, sizeof(buf)) != sizeof(buf) ||
+       read(fds[0], buf, sizeof(buf)) != sizeof(buf)){
+      printf("syscallbench: pipe i/o failed\n");
+      exit(1);
+    }
+  }
+  rate("512-byte pipe writes and reads", n, start);
+  close(fds[0]);
+  close(fds[1]);
+
+  static char path[120];
+  memset(path, 'x', sizeof(path) - 1);
+  path[0] = '/';
+  start = uptime();
+  for(int i = 0; i < n; i++)
+    open(path, O_RDONLY);
+  rate("open()s of a 119-byte path", n, start);
+
+  exit(0);
+}
@@ -43,14 +43,38 @@ strlen(const char *s)
   return n;
 }
 
+// memset() and memmove() work like the kernel's (kernel/string.c):
+// eight bytes at a time and a cache line per loop iteration, once
+// the pointers are aligned.
+
 void*
 memset(void *dst, int c, uint n)
 {
-  char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uchar *d = (uchar*)dst;
+  uint64 *w, x;
+
+  for(; n > 0 && ((uint64)d & 7) != 0; n--)
+    *d++ = c;
+
+  x = (uchar)c;
+  x |= x << 8;
+  x |= x << 16;
+  x |= x << 32;
+  for(w = (uint64*)d; n >= 64; n -= 64, w += 8){
+    w[0] = x;
+    w[1] = x;
+    w[2] = x;
+    w[3] = x;
+    w[4] = x;
+    w[5] = x;
+    w[6] = x;
+    w[7] = x;
   }
+  for(; n >= 8; n -= 8)
+    *w++ = x;
+
+  for(d = (uchar*)w; n > 0; n--)
+    *d++ = c;
   return dst;
 }
 
@@ -106,23 +130,76 @@ atoi(const char *s)
   return n;
 }
 
+// Copy n bytes upward from s to d.
+static void
+copyup(uchar *d, const uchar *s, uint n)
+{
+  uint64 *wd;
+  const uint64 *ws;
+  uint64 a0, a1, a2, a3, a4, a5, a6, a7;
+
+  if((((uint64)d ^ (uint64)s) & 7) == 0){
+    for(; n > 0 && ((uint64)d & 7) != 0; n--)
+      *d++ = *s++;
+    wd = (uint64*)d;
+    ws = (const uint64*)s;
+    for(; n >= 64; n -= 64, wd += 8, ws += 8){
+      a0 = ws[0]; a1 = ws[1]; a2 = ws[2]; a3 = ws[3];
+      a4 = ws[4]; a5 = ws[5]; a6 = ws[6]; a7 = ws[7];
+      wd[0] = a0; wd[1] = a1; wd[2] = a2; wd[3] = a3;
+      wd[4] = a4; wd[5] = a5; wd[6] = a6; wd[7] = a7;
+    }
+    for(; n >= 8; n -= 8)
+      *wd++ = *ws++;
+    d = (uchar*)wd;
+    s = (const uchar*)ws;
+  }
+  while(n-- > 0)
+    *d++ = *s++;
+}
+
+// Copy n bytes downward, ending at d and s.
+static void
+copydown(uchar *d, const uchar *s, uint n)
+{
+  uint64 *wd;
+  const uint64 *ws;
+  uint64 a0, a1, a2, a3, a4, a5, a6, a7;
+
+  if((((uint64)d ^ (uint64)s) & 7) == 0){
+    for(; n > 0 && ((uint64)d & 7) != 0; n--)
+      *--d = *--s;
+    wd = (uint64*)d;
+    ws = (const uint64*)s;
+    for(; n >= 64; n -= 64){
+      wd -= 8;
+      ws -= 8;
+      a0 = ws[0]; a1 = ws[1]; a2 = ws[2]; a3 = ws[3];
+      a4 = ws[4]; a5 = ws[5]; a6 = ws[6]; a7 = ws[7];
+      wd[0] = a0; wd[1] = a1; wd[2] = a2; wd[3] = a3;
+      wd[4] = a4; wd[5] = a5; wd[6] = a6; wd[7] = a7;
+    }
+    for(; n >= 8; n -= 8)
+      *--wd = *--ws;
+    d = (uchar*)wd;
+    s = (const uchar*)ws;
+  }
+  while(n-- > 0)
+    *--d = *--s;
+}
+
 void*
 memmove(void *vdst, const void *vsrc, int n)
 {
-  char *dst;
-  const char *src;
-
-  dst = vdst;
-  src = vsrc;
-  if (src > dst) {
-    while(n-- > 0)
-      *dst++ = *src++;
-  } else {
-    dst += n;
-    src += n;
-    while(n-- > 0)
-      *--dst = *--src;
-  }
+  uchar *dst = vdst;
+  const uchar *src = vsrc;
+
+  if(n <= 0 || src == dst)
+    return vdst;
+  if(src < dst && src + n > dst)
+    copydown(dst + n, src + n, n);
+  else
+    copyup(dst, src, n);
   return vdst;
 }
 
@@ -23,6 +23,14 @@ char* sbrk(int);
 int sleep(int);
 int uptime(void);
 int waitx(int*, int* /*wtime*/, int* /*rtime*/);
+int freepages(void);
+int spawn(const char*, char**, int*);
+int hugeheap(int);
+void *mmap(void*, uint64, int, int, int, int);
+int munmap(void*, uint64);
+int swapstat(int*);
+int buddystat(int*);
+int settickets(int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -730,6 +730,52 @@ exectest(char *s)
 
 }
 
+// spawn() gives the child only the descriptors it is passed,
+// as its 0, 1 and 2.
+void
+spawntest(char *s)
+{
+  int fds[2], xstatus, pid;
+  char *echoargv[] = { "echo", "OK", 0 };
+  char buf[4];
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  int sfds[3] = { -1, fds[1], 2 };
+  pid = spawn("echo", echoargv, sfds);
+  if(pid < 0){
+    printf("%s: spawn echo failed\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  // the child has no copy of fds[1] at another fd, so
+  // its exit closes the pipe's last write end.
+  int n = 0, m;
+  while(n < sizeof(buf) && (m = read(fds[0], buf + n, sizeof(buf) - n)) > 0)
+    n += m;
+  close(fds[0]);
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: wait failed\n", s);
+    exit(1);
+  }
+  if(n != 3 || buf[0] != 'O' || buf[1] != 'K' || buf[2] != '\n'){
+    printf("%s: wrong output\n", s);
+    exit(1);
+  }
+
+  if(spawn("nosuchprogram", echoargv, sfds) != -1){
+    printf("%s: spawn of missing program succeeded\n", s);
+    exit(1);
+  }
+  sfds[0] = 100;
+  if(spawn("echo", echoargv, sfds) != -1){
+    printf("%s: spawn with bad fd succeeded\n", s);
+    exit(1);
+  }
+}
+
 // simple fork and pipe read/write
 
 void
@@ -2217,11 +2263,13 @@ sbrkfail(char *s)
   if(pid == 0){
     // allocate a lot of memory.
     // this should produce a page fault,
-    // and thus not complete.
+    // and thus not complete. (reads alone would
+    // just map the shared zero page, so write.)
     a = sbrk(0);
     sbrk(10*BIG);
     int n = 0;
     for (i = 0; i < 10*BIG; i += PGSIZE) {
+      *(a+i) = 1;
       n += *(a+i);
     }
     // print n so the compiler doesn't optimize away
@@ -2593,6 +2641,7 @@ struct test {
   {createtest, "createtest"},
   {dirtest, "dirtest"},
   {exectest, "exectest"},
+  {spawntest, "spawntest"},
   {pipe1, "pipe1"},
   {killstatus, "killstatus"},
   {preempt, "preempt"},
@@ -36,4 +36,12 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
-entry("waitx");
\ No newline at end of file
+entry("waitx");
+entry("freepages");
+entry("spawn");
+entry("hugeheap");
+entry("mmap");
+entry("munmap");
+entry("swapstat");
+entry("buddystat");
+entry("settickets");